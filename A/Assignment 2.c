@@ -1,6 +1,39 @@
 
 
 //Development platform: workbench2
+//Remark: the workers synchronize with a sense-reversing barrier (spin, then futex) and reduce max_diff
+//        from per-thread cache-line-padded slots, --sync sem keeps the original semaphore handshake
+//        with the master thread; --bench-sync compares the two schemes over 1..T threads
+//        each row is updated by a vectorized kernel (SSE2, AVX2 or AVX-512, picked at startup from CPUID)
+//        that fuses the stencil with the max-abs-diff reduction; --kernel forces one of them
+//        --tile K runs K iterations per pass on cache-sized tiles with K-cell ghost zones (overlapped
+//        temporal tiling), recording the diff of every step; a pass that converges midway is redone up to that step
+//        --check-interval K|auto sweeps without computing any diff between checks; the grid is saved at every
+//        check and a converged check replays from the save to report the exact iteration
+//        --solver sor|mg replaces Jacobi with red-black SOR or a geometric multigrid V-cycle, both run by the
+//        same row-partitioned barrier workers; an iteration is a full SOR sweep or a whole V-cycle and stops
+//        when it changes no temperature by more than EPSILON
+//        --decomp blocks splits the Jacobi grid into a Pr x Pc grid of blocks instead of row strips, --first-touch
+//        lets every worker initialize its own part of u and w (pages land on its NUMA node), --pin binds worker i
+//        to the i-th allowed CPU
+//        the solution is written as a binary grid (64-byte header, then the doubles row by row) by parallel pwrite,
+//        --output text keeps the %6.2f file and --to-text converts a binary grid; --checkpoint FILE --checkpoint-every K
+//        saves u and the iteration count every K iterations (atomically, by rename) and --restart FILE resumes from it
+//        heat_create/heat_solve/heat_destroy solve a grid held in its own context, in the calling thread (no globals)
+//        or, as main does, on the T workers; heat_pool_* run many of them at once on a pool of T threads; --batch FILE
+//        solves one grid per line that way, and --top --bottom --left --right --initial set the boundary and initial
+//        temperatures
+//        --active-set splits the Jacobi grid into tiles and freezes the ones that, with their neighbours, have stopped
+//        changing; a neighbour that changes again wakes them, and convergence is only accepted on a sweep of every tile
+//        --precision float|mixed stores the Jacobi grids as float (computing in float, or in double with the residual
+//        taken in double), with kernels generated from one macro per width; --accuracy solves again in double and
+//        reports the error of the float solution
+//        --bench-suite csv|json runs the chosen configuration on grids sized for L1, L2, the LLC and DRAM over 1..T
+//        threads (strong scaling) and on a grid growing with the threads (weak scaling), reporting iterations/sec,
+//        cell updates/sec, GFLOP/s and the effective memory bandwidth of every run
+//        --instrument timestamps (TSC) the sweep, barrier wait and reduction of every iteration of the barrier Jacobi
+//        workers into per-thread rings and reports the time split and imbalance histograms; --trace FILE also writes
+//        the kept iterations as a Chrome trace (chrome://tracing, Perfetto)
 
 #define _GNU_SOURCE
 
@@ -14,11 +47,26 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <getopt.h>
+#include <time.h>
+#include <sched.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 /****************Global****************************/
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define EPSILON 0.001 /* Termination condition */
+#define CACHE_LINE 64 /* Bytes per cache line, the unit of false sharing */
 
 char *filename; /* File name of output file */
 
@@ -39,134 +87,2520 @@ double **w; /* New temperatures */
 // (1) Add your variables here
 
 double max_diff = 0.0; /* Maximum temperature difference */
-sem_t start,finish, mutex,sig;   /*transit infomation among threads*/
+sem_t start,finish, mutex;   /*transit infomation among threads*/
+sem_t *sig;                  /* one per worker, so a fast worker cannot take the release meant for another */
 int StopOrCtn = 0;     /* stop=0, continue=1 */
 double **stat;            /* store the worker thread running statistic */
 
+/* Barrier scheme: the workers synchronize among themselves, no master thread in the loop */
+enum { SYNC_SEM, SYNC_BARRIER };
+int sync_mode = SYNC_BARRIER; /* --sync sem|barrier */
+int quiet = 0;                /* 1 to skip the per-thread report (benchmarks) */
+
+typedef struct
+{
+   atomic_int count;    /* Threads still to arrive in this phase */
+   atomic_int sense;    /* Flips when the last thread arrives */
+   atomic_int sleepers; /* Threads blocked in futex_wait */
+   int total;           /* Threads taking part */
+   int spin;            /* Polls of sense before sleeping */
+} barrier_t;
+
+typedef struct
+{
+   double v;
+   char pad[CACHE_LINE - sizeof(double)];
+} __attribute__((aligned(CACHE_LINE))) padded_double;
+
+barrier_t bar;
+padded_double *diff_slot; /* [2][thr_count] per-thread max diff, double-buffered by iteration parity */
+int barrier_its;          /* Iteration count found by the barrier workers */
+int bench_sync = 0;       /* --bench-sync: iterations/sec of both schemes against the thread count */
+long bench_its = 2000;    /* --bench-its: iterations per benchmark run */
+enum { SUITE_OFF, SUITE_CSV, SUITE_JSON };
+int bench_suite = SUITE_OFF; /* --bench-suite csv|json */
+#define BENCH_MIN_TIME 0.5   /* Seconds every suite configuration runs for, in as many solves as it takes */
+#define BENCH_UPDATES 2e8    /* Cell updates per solve: the iteration limit of a grid, at least BENCH_MIN_ITS */
+#define BENCH_MIN_ITS 10
+#define BENCH_DRAM 4         /* The DRAM grid is this many times the LLC */
+
+/* Row kernel: out[c] for c = 1..n-2 from the rows above, at and below, returns the maximum |out - mid| */
+typedef double (*row_kernel_t)(const double *up, const double *mid, const double *down, double *out, int n);
+row_kernel_t row_kernel;  /* Chosen by select_kernel() */
+/* The same update without the diff, for the sweeps between convergence checks */
+typedef void (*row_stencil_t)(const double *up, const double *mid, const double *down, double *out, int n);
+row_stencil_t row_stencil;
+const char *kernel_name;  /* --kernel scalar|sse2|avx2|avx512|auto */
+
+/* Temporal tiling (barrier scheme only) */
+int tile_steps = 1;       /* --tile K: iterations per pass, 1 = plain sweeps */
+int tile_rows = 0;        /* --tile-rows B: rows of a tile, 0 = sized to fit TILE_CACHE */
+int tile_cols = 0;        /* --tile-cols C: columns of a tile, 0 = sized to fit TILE_CACHE */
+#define TILE_CACHE (512 * 1024) /* Bytes of cache the two buffers of a tile and its ghost zone should fit in */
+int step_stride;          /* Doubles per worker in step_slot, a whole number of cache lines */
+double *step_slot;        /* [2][thr_count][step_stride] per-step max diff of every worker */
+
+/* Sparse convergence checks (barrier scheme, untiled) */
+int check_interval = 1;   /* --check-interval K: iterations between checks, 0 = auto */
+#define CHECK_MAX 4096    /* Largest interval the auto mode picks */
+double **snap;            /* Grid as of the last check that had not converged */
+
+/* Solver engine (barrier scheme) */
+enum { SOLVER_JACOBI, SOLVER_SOR, SOLVER_MG };
+int solver = SOLVER_JACOBI; /* --solver jacobi|sor|mg */
+double omega = 0.0;         /* --omega: SOR relaxation factor, 0 = optimal for the grid */
+#define MG_MIN 5            /* A dimension is not coarsened below this many points */
+#define MG_PRE 2            /* Red-black Gauss-Seidel sweeps before the coarse-grid correction */
+#define MG_POST 2           /* and after it */
+#define MG_COARSEST 30      /* Sweeps on the coarsest grid */
+
+/* One multigrid level: the grid spans the same domain as the fine one with its own spacing, the
+   operator is the 5-point Laplacian (2u - up - down) * ar + (2u - left - right) * ac */
+typedef struct
+{
+   int rows, cols;
+   double ar, ac; /* 1/h^2 along rows and columns, the fine grid has h = 1 */
+   double **u;    /* Solution (level 0) or correction */
+   double **f;    /* Right-hand side, NULL on level 0 (Laplace) */
+   double **r;    /* Residual, zero on the border */
+} mg_level;
+
+mg_level *levels;
+int nlevels;
+
+/* Active set (barrier scheme, Jacobi) */
+int active_set = 0;       /* --active-set: sweep only the tiles that still change */
+#define ACTIVE_ROWS 32    /* Default tile size, --tile-rows and --tile-cols override it */
+#define ACTIVE_COLS 128
+#define ACTIVE_RATIO 0.01 /* A tile is calm while it and its neighbours change by less than EPSILON * ACTIVE_RATIO */
+#define ACTIVE_CALM 16    /* Calm iterations in a row before a tile is frozen */
+int act_bands, act_cols;  /* Tiles per column and per row */
+int *band_r0;             /* [act_bands + 1] first row of every band of tiles, band_r0[act_bands] = M - 1 */
+int *band_first;          /* [thr_count + 1] first band of every worker, the bands split the worker's rows */
+double *tile_diff;        /* [2][act_bands * act_cols] max change of every tile by iteration parity, -1 if frozen */
+atomic_long act_swept;    /* Tile sweeps done */
+atomic_long act_skipped;  /* and skipped */
+
+/* Storage precision (barrier scheme, Jacobi) */
+enum { PREC_DOUBLE, PREC_FLOAT, PREC_MIXED };
+int precision = PREC_DOUBLE; /* --precision double|float|mixed */
+int accuracy_report = 0;     /* --accuracy: compare the float solution with a double one */
+/* Row kernel on float rows, returns the maximum change of a stored value */
+typedef double (*row_float_t)(const float *up, const float *mid, const float *down, float *out, int n);
+row_float_t row_float;       /* Chosen by select_kernel() for the precision and the width of row_kernel */
+float **fu, **fw;            /* Float grids */
+
+/* Instrumentation (barrier Jacobi workers) */
+#define TRACE_RING 4096    /* Iterations kept per thread, a power of two */
+typedef struct
+{
+   int its;
+   uint64_t t[4];         /* Start, end of the sweep, end of the barrier wait, end of the reduction */
+} trace_rec;
+
+typedef struct
+{
+   trace_rec *ring;       /* [TRACE_RING] the last iterations, iteration its in slot its % TRACE_RING */
+   trace_rec cur;
+   long iterations;
+   uint64_t sum[3];       /* Sweep, wait and reduction ticks over every iteration */
+} __attribute__((aligned(CACHE_LINE))) trace_thread;
+
+int instrument = 0;       /* --instrument */
+char *trace_path;         /* --trace FILE: Chrome trace of the kept iterations */
+trace_thread *traces;     /* [thr_count] */
+uint64_t trace_tick0;     /* Clock of trace_now() and CLOCK_MONOTONIC at the start, to convert ticks */
+struct timespec trace_mono0;
+
+/* Work placement */
+int decomp_blocks = 0;    /* --decomp rows|blocks */
+int blk_rows = 1, blk_cols = 1; /* Blocks per column and per row of the decomposition */
+int first_touch = 0;      /* --first-touch: workers initialize their own part of u and w */
+int pin_threads = 0;      /* --pin: one CPU per worker */
+
+/* Binary grid files: the solution, checkpoints */
+#define GRID_MAGIC "HEATGRID"
+typedef struct
+{
+   char magic[8];      /* GRID_MAGIC */
+   uint32_t version;   /* 1 */
+   uint32_t rows;      /* M */
+   uint32_t cols;      /* N */
+   uint32_t reserved;
+   int64_t iterations; /* Iterations done to reach this grid */
+   double diff;        /* Max change of the last iteration */
+   char pad[24];       /* Header is 64 bytes, the doubles that follow stay aligned */
+} grid_header;
+
+int text_output = 0;      /* --output text|binary */
+char *checkpoint_path;    /* --checkpoint FILE */
+int checkpoint_every = 0; /* --checkpoint-every K */
+int checkpoint_fd = -1;   /* Temporary file of the checkpoint being written */
+atomic_int checkpoint_errors; /* Workers whose part of the checkpoint was not written */
+int restart_fd = -1;      /* --restart FILE */
+atomic_int restart_errors; /* Workers whose part of the restart file could not be read */
+int restart_its = 0;      /* Iterations already done by the restart grid */
+
+/* Reentrant solver: everything a solve needs lives in its context */
+typedef struct
+{
+   int rows, cols;
+   double top, bottom, left, right; /* Boundary temperatures, the top and bottom rows include the corners */
+   double initial;                  /* Interior temperature at the start */
+   double epsilon;                  /* Termination condition */
+   long max_its;
+   int solver;                      /* SOLVER_JACOBI or SOLVER_SOR (or SOLVER_MG on workers) */
+   double omega;                    /* SOR relaxation factor, 0 = optimal for the grid */
+   int threads;                     /* 0 = solve in the calling thread, T = on T workers with the options */
+} heat_params;
+
+typedef struct heat_ctx
+{
+   heat_params p;
+   double **u;            /* Solution */
+   double **w;            /* Previous iterate (Jacobi) */
+   int its;               /* Iterations to converge, max_its + 1 if it did not */
+   double diff;           /* Max change of the last iteration */
+   struct heat_ctx *next; /* Pool queue */
+} heat_ctx;
+
+typedef struct
+{
+   pthread_t *threads;
+   int count;
+   pthread_mutex_t lock;
+   pthread_cond_t work, idle;
+   heat_ctx *head, *tail; /* Submitted, not yet started */
+   int busy;              /* Contexts being solved */
+   int stop;
+} heat_pool;
+
+heat_params grid_params; /* The global grid, from heat_params_default and the options; --batch lines start from it */
+const heat_params *solve_params = &grid_params; /* Grid of the workers: heat_solve points it at its context */
+char *batch_path;         /* --batch FILE */
+
 /**************************************************************/
 
-int main(int argc, char *argv[])
+int main(int argc, char *argv[])
+{
+   int its;                     /* Iterations to converge */
+   double elapsed;              /* Execution time */
+   struct timeval stime, etime; /* Start and end times */
+   struct rusage usage;
+   heat_params run;             /* The grid solved by this run */
+   heat_ctx *ctx;
+
+   void allocate_2d_array(int, int, double ***);
+   void print_solution(char *, double **);
+   void sync_benchmark(void);
+   void select_kernel(void);
+   void choose_blocks(void);
+   int convert_to_text(char *);
+   int grid_open(const char *, grid_header *, int, int);
+   void write_binary(char *, double **, long, double);
+   int run_batch(char *);
+   int heat_resolve(heat_params *);
+   heat_ctx *heat_create(const heat_params *);
+   int heat_solve(heat_ctx *);
+   void heat_destroy(heat_ctx *);
+   void precision_accuracy(int, double);
+   void bench_suite_run(void);
+   void heat_params_default(heat_params *);
+
+   static struct option long_opts[] = {
+       {"sync", required_argument, 0, 's'},
+       {"bench-sync", no_argument, 0, 'B'},
+       {"bench-its", required_argument, 0, 'I'},
+       {"kernel", required_argument, 0, 'k'},
+       {"tile", required_argument, 0, 't'},
+       {"tile-rows", required_argument, 0, 'r'},
+       {"tile-cols", required_argument, 0, 'c'},
+       {"check-interval", required_argument, 0, 'K'},
+       {"solver", required_argument, 0, 'S'},
+       {"omega", required_argument, 0, 'w'},
+       {"decomp", required_argument, 0, 'D'},
+       {"first-touch", no_argument, 0, 'F'},
+       {"pin", no_argument, 0, 'P'},
+       {"output", required_argument, 0, 'o'},
+       {"to-text", required_argument, 0, 'T'},
+       {"checkpoint", required_argument, 0, 'C'},
+       {"checkpoint-every", required_argument, 0, 'E'},
+       {"restart", required_argument, 0, 'R'},
+       {"batch", required_argument, 0, 'b'},
+       {"top", required_argument, 0, 1},
+       {"bottom", required_argument, 0, 2},
+       {"left", required_argument, 0, 3},
+       {"right", required_argument, 0, 4},
+       {"initial", required_argument, 0, 5},
+       {"active-set", no_argument, 0, 'A'},
+       {"precision", required_argument, 0, 'p'},
+       {"accuracy", no_argument, 0, 'a'},
+       {"bench-suite", required_argument, 0, 'U'},
+       {"instrument", no_argument, 0, 'i'},
+       {"trace", required_argument, 0, 'x'},
+       {0, 0, 0, 0}};
+   int opt;
+   char *restart_path = NULL;
+   grid_header restart_header;
+
+   heat_params_default(&grid_params);
+   while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+   {
+      switch (opt)
+      {
+      case 's':
+         if (strcmp(optarg, "sem") == 0)
+            sync_mode = SYNC_SEM;
+         else if (strcmp(optarg, "barrier") == 0)
+            sync_mode = SYNC_BARRIER;
+         else
+         {
+            printf("--sync must be sem or barrier\n");
+            exit(-1);
+         }
+         break;
+      case 'B':
+         bench_sync = 1;
+         break;
+      case 'I':
+         bench_its = atol(optarg);
+         break;
+      case 'k':
+         kernel_name = optarg;
+         break;
+      case 't':
+         tile_steps = atoi(optarg);
+         break;
+      case 'r':
+         tile_rows = atoi(optarg);
+         break;
+      case 'c':
+         tile_cols = atoi(optarg);
+         break;
+      case 'S':
+         if (strcmp(optarg, "jacobi") == 0)
+            solver = SOLVER_JACOBI;
+         else if (strcmp(optarg, "sor") == 0)
+            solver = SOLVER_SOR;
+         else if (strcmp(optarg, "mg") == 0)
+            solver = SOLVER_MG;
+         else
+            goto usage;
+         break;
+      case 'w':
+         omega = atof(optarg);
+         break;
+      case 'D':
+         if (strcmp(optarg, "rows") == 0)
+            decomp_blocks = 0;
+         else if (strcmp(optarg, "blocks") == 0)
+            decomp_blocks = 1;
+         else
+            goto usage;
+         break;
+      case 'F':
+         first_touch = 1;
+         break;
+      case 'P':
+         pin_threads = 1;
+         break;
+      case 'o':
+         if (strcmp(optarg, "text") == 0)
+            text_output = 1;
+         else if (strcmp(optarg, "binary") == 0)
+            text_output = 0;
+         else
+            goto usage;
+         break;
+      case 'T':
+         return convert_to_text(optarg) == 0 ? 0 : -1;
+      case 'C':
+         checkpoint_path = optarg;
+         break;
+      case 'E':
+         checkpoint_every = atoi(optarg);
+         break;
+      case 'R':
+         restart_path = optarg;
+         break;
+      case 'b':
+         batch_path = optarg;
+         break;
+      case 'A':
+         active_set = 1;
+         break;
+      case 'p':
+         if (strcmp(optarg, "float") == 0)
+            precision = PREC_FLOAT;
+         else if (strcmp(optarg, "mixed") == 0)
+            precision = PREC_MIXED;
+         else if (strcmp(optarg, "double") == 0)
+            precision = PREC_DOUBLE;
+         else
+            goto usage;
+         break;
+      case 'a':
+         accuracy_report = 1;
+         break;
+      case 'i':
+         instrument = 1;
+         break;
+      case 'x':
+         trace_path = optarg;
+         instrument = 1;
+         break;
+      case 'U':
+         if (strcmp(optarg, "csv") == 0)
+            bench_suite = SUITE_CSV;
+         else if (strcmp(optarg, "json") == 0)
+            bench_suite = SUITE_JSON;
+         else
+            goto usage;
+         break;
+      case 1:
+         grid_params.top = atof(optarg);
+         break;
+      case 2:
+         grid_params.bottom = atof(optarg);
+         break;
+      case 3:
+         grid_params.left = atof(optarg);
+         break;
+      case 4:
+         grid_params.right = atof(optarg);
+         break;
+      case 5:
+         grid_params.initial = atof(optarg);
+         break;
+      case 'K':
+         check_interval = strcmp(optarg, "auto") == 0 ? 0 : atoi(optarg);
+         if (check_interval < 0 || (check_interval == 0 && strcmp(optarg, "auto") != 0))
+            goto usage;
+         break;
+      default:
+         goto usage;
+      }
+   }
+
+   /* For convenience of other problem size testing */
+   if ((argc - optind == 0) || (argc - optind == 3))
+   {
+      if (argc - optind == 3)
+      {
+         M = atoi(argv[optind]);
+         N = atoi(argv[optind + 1]);
+         thr_count = atoi(argv[optind + 2]);
+      } // Otherwise use default grid and thread size
+   }
+   else
+   {
+   usage:
+      printf("Usage: %s [--sync sem|barrier] [--bench-sync [--bench-its N]] [--bench-suite csv|json]\n"
+             "       [--kernel scalar|sse2|avx2|avx512|auto]\n"
+             "       [--tile K [--tile-rows B] [--tile-cols C]] [--check-interval K|auto]\n"
+             "       [--solver jacobi|sor|mg [--omega W]] [--decomp rows|blocks] [--first-touch] [--pin]\n"
+             "       [--output binary|text] [--checkpoint FILE --checkpoint-every K] [--restart FILE]\n"
+             "       [--active-set [--tile-rows B] [--tile-cols C]] [--precision double|float|mixed [--accuracy]]\n"
+             "       [--instrument] [--trace FILE]\n"
+             "       [--to-text FILE] [--batch FILE] [--top T] [--bottom T] [--left T] [--right T] [--initial T]\n"
+             "       [ <rows> <cols> <threads> ]\n", argv[0]);
+      exit(-1);
+   }
+   if (M < 3 || N < 3 || thr_count < 1 || thr_count > M - 2 || bench_its < 1)
+   {
+      printf("Need rows, cols >= 3 and 1 <= threads <= rows - 2\n");
+      exit(-1);
+   }
+   if (tile_steps < 1 || tile_rows < 0 || tile_cols < 0 || (tile_steps > 1 && sync_mode == SYNC_SEM))
+   {
+      printf("--tile needs K >= 1 and the barrier scheme\n");
+      exit(-1);
+   }
+   if (check_interval != 1 && (sync_mode == SYNC_SEM || tile_steps > 1))
+   {
+      printf("--check-interval needs the barrier scheme without --tile\n");
+      exit(-1);
+   }
+   if (solver != SOLVER_JACOBI &&
+       (sync_mode == SYNC_SEM || tile_steps > 1 || check_interval != 1 || bench_sync))
+   {
+      printf("--solver sor|mg needs the barrier scheme without --tile, --check-interval or --bench-sync\n");
+      exit(-1);
+   }
+   if (decomp_blocks && (sync_mode == SYNC_SEM || tile_steps > 1 || solver != SOLVER_JACOBI))
+   {
+      printf("--decomp blocks needs Jacobi with the barrier scheme and without --tile\n");
+      exit(-1);
+   }
+   if (first_touch && (sync_mode == SYNC_SEM || bench_sync))
+   {
+      printf("--first-touch needs the barrier scheme without --bench-sync\n");
+      exit(-1);
+   }
+   if (active_set && (sync_mode == SYNC_SEM || tile_steps > 1 || check_interval != 1 || solver != SOLVER_JACOBI ||
+                      decomp_blocks || bench_sync))
+   {
+      printf("--active-set needs Jacobi with the barrier scheme, row strips and no --tile or --check-interval\n");
+      exit(-1);
+   }
+   if ((precision != PREC_DOUBLE &&
+        (sync_mode == SYNC_SEM || tile_steps > 1 || check_interval != 1 || solver != SOLVER_JACOBI || decomp_blocks ||
+         active_set || bench_sync || batch_path || checkpoint_path || restart_path)) ||
+       (accuracy_report && precision == PREC_DOUBLE))
+   {
+      printf("--precision float|mixed needs plain Jacobi with the barrier scheme, --accuracy needs --precision\n");
+      exit(-1);
+   }
+   if (instrument && (sync_mode == SYNC_SEM || tile_steps > 1 || solver != SOLVER_JACOBI || batch_path))
+   {
+      printf("--instrument and --trace need Jacobi with the barrier scheme, without --tile or --batch\n");
+      exit(-1);
+   }
+   if (bench_suite && (solver == SOLVER_MG || bench_sync || batch_path || checkpoint_path || restart_path ||
+                       accuracy_report))
+   {
+      printf("--bench-suite runs jacobi or sor, without --bench-sync, --batch, --checkpoint, --restart or --accuracy\n");
+      exit(-1);
+   }
+   if (batch_path && (solver == SOLVER_MG || bench_sync || checkpoint_path || restart_path))
+   {
+      printf("--batch solves with jacobi or sor, without --bench-sync, --checkpoint or --restart\n");
+      exit(-1);
+   }
+   if (decomp_blocks)
+      choose_blocks();
+   if ((checkpoint_every > 0) != (checkpoint_path != NULL) || checkpoint_every < 0)
+   {
+      printf("--checkpoint and --checkpoint-every K > 0 go together\n");
+      exit(-1);
+   }
+   if ((checkpoint_path || restart_path) &&
+       (sync_mode == SYNC_SEM || tile_steps > 1 || solver != SOLVER_JACOBI || bench_sync ||
+        (checkpoint_path && check_interval != 1)))
+   {
+      printf("--checkpoint and --restart need Jacobi with the barrier scheme (no --tile, no --check-interval"
+             " with --checkpoint)\n");
+      exit(-1);
+   }
+   if (restart_path)
+   {
+      restart_fd = grid_open(restart_path, &restart_header, M, N);
+      if (restart_fd < 0)
+      {
+         printf("%s is not a %dx%d grid file\n", restart_path, M, N);
+         exit(-1);
+      }
+      restart_its = (int)restart_header.iterations;
+   }
+   if (omega < 0.0 || omega >= 2.0)
+   {
+      printf("--omega must be in (0, 2)\n");
+      exit(-1);
+   }
+   grid_params.rows = M;
+   grid_params.cols = N;
+   grid_params.max_its = max_its;
+   grid_params.solver = solver;
+   grid_params.omega = omega;
+   run = grid_params; /* The grid of this run; --batch grids resolve their own omega */
+   run.threads = thr_count;
+   heat_resolve(&run);
+   omega = run.omega;
+   if (tile_steps > 1)
+   {
+      /* Square tiles by default, at least as wide as the ghost zone */
+      int side = MAX(2 * tile_steps, (int)sqrt(TILE_CACHE / (2 * sizeof(double))) - 2 * tile_steps);
+
+      if (tile_rows == 0)
+         tile_rows = side;
+      if (tile_cols == 0)
+         tile_cols = side;
+   }
+   if (active_set)
+   {
+      if (tile_rows == 0)
+         tile_rows = ACTIVE_ROWS;
+      if (tile_cols == 0)
+         tile_cols = ACTIVE_COLS;
+   }
+
+   select_kernel();
+   if (bench_suite)
+   {
+      bench_suite_run(); /* Only the tables on stdout */
+      return 0;
+   }
+   printf("Problem size: M=%d, N=%d\nThread count: T=%d\nKernel: %s\n", M, N, thr_count, kernel_name);
+   if (tile_steps > 1)
+      printf("Tiling: %d iterations per pass, %dx%d tiles\n", tile_steps, tile_rows, tile_cols);
+   if (solver == SOLVER_SOR)
+      printf("Solver: red-black SOR, omega = %.4f\n", omega);
+   else if (solver == SOLVER_MG)
+      printf("Solver: multigrid V(%d,%d) cycles\n", MG_PRE, MG_POST);
+   if (precision != PREC_DOUBLE)
+      printf("Precision: float storage, %s arithmetic\n", precision == PREC_MIXED ? "double" : "float");
+   if (active_set)
+      printf("Active set: %dx%d tiles, frozen below %g\n", tile_rows, tile_cols, run.epsilon * ACTIVE_RATIO);
+   if (decomp_blocks)
+      printf("Decomposition: %dx%d blocks\n", blk_rows, blk_cols);
+   if (first_touch || pin_threads)
+      printf("Placement:%s%s\n", first_touch ? " first-touch" : "", pin_threads ? " pinned" : "");
+   if (restart_fd >= 0)
+      printf("Restart: %s after %d iterations\n", restart_path, restart_its);
+   if (checkpoint_path)
+      printf("Checkpoint: %s every %d iterations\n", checkpoint_path, checkpoint_every);
+   if (check_interval == 0)
+      printf("Convergence check: adaptive interval\n");
+   else if (check_interval > 1)
+      printf("Convergence check: every %d iterations\n", check_interval);
+
+   if (batch_path)
+      return run_batch(batch_path) == 0 ? 0 : -1;
+
+   if (bench_sync)
+   {
+      allocate_2d_array(M, N, &u);
+      allocate_2d_array(M, N, &w);
+      sync_benchmark();
+      return 0;
+   }
+
+   /* Create the output file */
+   filename = malloc(strlen(argv[0]) + 5);
+   sprintf(filename, "%s.%s", argv[0], text_output ? "dat" : "bin");
+
+   ctx = heat_create(&run);
+   gettimeofday(&stime, NULL);
+   its = heat_solve(ctx);
+   gettimeofday(&etime, NULL);
+
+   elapsed = ((etime.tv_sec * 1000000 + etime.tv_usec) - (stime.tv_sec * 1000000 + stime.tv_usec)) / 1000000.0;
+
+   printf("Converged after %d iterations with error: %8.6f.\n", its, ctx->diff);
+   printf("Elapsed time = %8.4f sec.\n", elapsed);
+
+   getrusage(RUSAGE_SELF, &usage);
+   printf("Program completed - user: %.4f s, system: %.4f s\n",
+          (usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0),
+          (usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0));
+   printf("no. of context switches: vol %ld, invol %ld\n\n",
+          usage.ru_nvcsw, usage.ru_nivcsw);
+
+   if (text_output)
+      print_solution(filename, ctx->w);
+   else
+      write_binary(filename, ctx->w, its, ctx->diff);
+
+   if (accuracy_report)
+      precision_accuracy(its, elapsed);
+   heat_destroy(ctx);
+}
+
+/* Allocate two-dimensional array. */
+void allocate_2d_array(int r, int c, double ***a)
+{
+   double *storage;
+   int i;
+   storage = (double *)malloc(r * c * sizeof(double));
+   *a = (double **)malloc(r * sizeof(double *));
+   for (i = 0; i < r; i++)
+      (*a)[i] = &storage[i * c];
+}
+
+void allocate_2d_float(int r, int c, float ***a)
+{
+   float *storage = (float *)malloc((size_t)r * c * sizeof(float));
+
+   *a = (float **)malloc(r * sizeof(float *));
+   for (int i = 0; i < r; i++)
+      (*a)[i] = &storage[i * c];
+}
+
+/* --accuracy: solve the grid again in double and compare the float solution in u with it */
+void precision_accuracy(int its, double elapsed)
+{
+   void allocate_2d_array(int, int, double ***);
+   void initialize_array(double ***);
+   int find_steady_state(void);
+   void copy_rows(double **, double **, int, int);
+   double **lo, err, max_err = 0.0, sum = 0.0, ref_elapsed;
+   int lo_precision = precision, ref_its, i, j;
+   struct timeval stime, etime;
+
+   allocate_2d_array(M, N, &lo);
+   copy_rows(u, lo, 0, M - 1);
+   initialize_array(&u);
+   initialize_array(&w);
+   precision = PREC_DOUBLE;
+   quiet = 1;
+   gettimeofday(&stime, NULL);
+   ref_its = find_steady_state();
+   gettimeofday(&etime, NULL);
+   quiet = 0;
+   precision = lo_precision;
+   ref_elapsed = ((etime.tv_sec * 1000000 + etime.tv_usec) - (stime.tv_sec * 1000000 + stime.tv_usec)) / 1000000.0;
+
+   for (i = 0; i < M; i++)
+      for (j = 0; j < N; j++)
+      {
+         err = fabs(lo[i][j] - u[i][j]);
+         max_err = MAX(max_err, err);
+         sum += err * err;
+      }
+   printf("Accuracy of %s against double: max |error| %.3e, rms error %.3e\n",
+          precision == PREC_MIXED ? "mixed" : "float", max_err, sqrt(sum / ((double)M * N)));
+   printf("  %d iterations in %.4f sec against %d in %.4f sec (%.2fx)\n", its, elapsed, ref_its, ref_elapsed,
+          ref_elapsed / elapsed);
+   free(lo[0]);
+   free(lo);
+}
+
+/* Initial temperature of cell (i, j) */
+double initial_value(const heat_params *p, int i, int j)
+{
+   if (i == p->rows - 1)
+      return p->bottom; /* Heat source */
+   if (i == 0)
+      return p->top;
+   if (j == 0)
+      return p->left;
+   if (j == p->cols - 1)
+      return p->right;
+   return p->initial; /* Room temperature */
+}
+
+/* Set initial and boundary conditions of rows r0..r1, columns c0..c1 */
+void initialize_block(double **u, int r0, int r1, int c0, int c1)
+{
+   int i, j;
+
+   for (i = r0; i <= r1; i++)
+      for (j = c0; j <= c1; j++)
+         u[i][j] = initial_value(solve_params, i, j);
+}
+
+/* Set initial and boundary conditions */
+void initialize_array(double ***u)
+{
+   initialize_block(*u, 0, M - 1, 0, N - 1);
+}
+
+/* Print solution to standard output or a file */
+void print_solution(char *filename, double **u)
+{
+   int i, j;
+   char sep;
+   FILE *outfile;
+
+   if (!filename)
+   {              /* if no filename specified, print on screen */
+      sep = '\t'; /* tab added for easier view */
+      outfile = stdout;
+   }
+   else
+   {
+      sep = '\n'; /* for gnuplot format */
+      outfile = fopen(filename, "w");
+      if (outfile == NULL)
+      {
+         printf("Can't open output file.");
+         exit(-1);
+      }
+   }
+
+   /* Print the solution array */
+   for (i = 0; i < M; i++)
+   {
+      for (j = 0; j < N; j++)
+         fprintf(outfile, "%6.2f%c", u[i][j], sep);
+      fprintf(outfile, "\n"); /* Empty line for gnuplot */
+   }
+   if (outfile != stdout)
+      fclose(outfile);
+}
+
+/* The vector kernels add the four neighbours in the same order as the scalar one and use no FMA,
+   so every variant produces bit-identical grids */
+
+/* Scalar remainder of a vector kernel, expanded inside it: calling the legacy-SSE row_scalar from
+   AVX code with dirty upper registers costs a state transition per row */
+#define ROW_TAIL(c, n, diff)                                                      \
+   for (; (c) < (n) - 1; (c)++)                                                   \
+   {                                                                              \
+      out[c] = 0.25 * (up[c] + down[c] + mid[(c) - 1] + mid[(c) + 1]);            \
+      if (fabs(out[c] - mid[c]) > (diff))                                         \
+         (diff) = fabs(out[c] - mid[c]);                                          \
+   }
+
+double row_scalar(const double *up, const double *mid, const double *down, double *out, int n)
+{
+   double diff = 0.0;
+
+   for (int c = 1; c < n - 1; c++)
+   {
+      out[c] = 0.25 * (up[c] + down[c] + mid[c - 1] + mid[c + 1]);
+      if (fabs(out[c] - mid[c]) > diff)
+         diff = fabs(out[c] - mid[c]);
+   }
+   return diff;
+}
+
+void stencil_scalar(const double *up, const double *mid, const double *down, double *out, int n)
+{
+   for (int c = 1; c < n - 1; c++)
+      out[c] = 0.25 * (up[c] + down[c] + mid[c - 1] + mid[c + 1]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+void stencil_sse2(const double *up, const double *mid, const double *down, double *out, int n)
+{
+   const __m128d quarter = _mm_set1_pd(0.25);
+   int c = 1;
+
+   for (; c + 2 <= n - 1; c += 2)
+   {
+      __m128d sum = _mm_add_pd(_mm_loadu_pd(up + c), _mm_loadu_pd(down + c));
+      sum = _mm_add_pd(sum, _mm_loadu_pd(mid + c - 1));
+      sum = _mm_add_pd(sum, _mm_loadu_pd(mid + c + 1));
+      _mm_storeu_pd(out + c, _mm_mul_pd(quarter, sum));
+   }
+   for (; c < n - 1; c++)
+      out[c] = 0.25 * (up[c] + down[c] + mid[c - 1] + mid[c + 1]);
+}
+
+__attribute__((target("avx2")))
+void stencil_avx2(const double *up, const double *mid, const double *down, double *out, int n)
+{
+   const __m256d quarter = _mm256_set1_pd(0.25);
+   int c = 1;
+
+   for (; c + 4 <= n - 1; c += 4)
+   {
+      __m256d sum = _mm256_add_pd(_mm256_loadu_pd(up + c), _mm256_loadu_pd(down + c));
+      sum = _mm256_add_pd(sum, _mm256_loadu_pd(mid + c - 1));
+      sum = _mm256_add_pd(sum, _mm256_loadu_pd(mid + c + 1));
+      _mm256_storeu_pd(out + c, _mm256_mul_pd(quarter, sum));
+   }
+   for (; c < n - 1; c++)
+      out[c] = 0.25 * (up[c] + down[c] + mid[c - 1] + mid[c + 1]);
+}
+
+__attribute__((target("avx512f")))
+void stencil_avx512(const double *up, const double *mid, const double *down, double *out, int n)
+{
+   const __m512d quarter = _mm512_set1_pd(0.25);
+   int c = 1;
+
+   for (; c + 8 <= n - 1; c += 8)
+   {
+      __m512d sum = _mm512_add_pd(_mm512_loadu_pd(up + c), _mm512_loadu_pd(down + c));
+      sum = _mm512_add_pd(sum, _mm512_loadu_pd(mid + c - 1));
+      sum = _mm512_add_pd(sum, _mm512_loadu_pd(mid + c + 1));
+      _mm512_storeu_pd(out + c, _mm512_mul_pd(quarter, sum));
+   }
+   for (; c < n - 1; c++)
+      out[c] = 0.25 * (up[c] + down[c] + mid[c - 1] + mid[c + 1]);
+}
+
+__attribute__((target("sse2")))
+double row_sse2(const double *up, const double *mid, const double *down, double *out, int n)
+{
+   const __m128d quarter = _mm_set1_pd(0.25), sign = _mm_set1_pd(-0.0);
+   __m128d vdiff = _mm_setzero_pd();
+   double diff, lanes[2];
+   int c = 1;
+
+   for (; c + 2 <= n - 1; c += 2)
+   {
+      __m128d centre = _mm_loadu_pd(mid + c);
+      __m128d sum = _mm_add_pd(_mm_loadu_pd(up + c), _mm_loadu_pd(down + c));
+      sum = _mm_add_pd(sum, _mm_loadu_pd(mid + c - 1));
+      sum = _mm_add_pd(sum, _mm_loadu_pd(mid + c + 1));
+      sum = _mm_mul_pd(quarter, sum);
+      _mm_storeu_pd(out + c, sum);
+      vdiff = _mm_max_pd(vdiff, _mm_andnot_pd(sign, _mm_sub_pd(sum, centre)));
+   }
+   _mm_storeu_pd(lanes, vdiff);
+   diff = MAX(lanes[0], lanes[1]);
+   ROW_TAIL(c, n, diff);
+   return diff;
+}
+
+__attribute__((target("avx2")))
+double row_avx2(const double *up, const double *mid, const double *down, double *out, int n)
+{
+   const __m256d quarter = _mm256_set1_pd(0.25), sign = _mm256_set1_pd(-0.0);
+   __m256d vdiff = _mm256_setzero_pd();
+   double diff, lanes[4];
+   int c = 1;
+
+   for (; c + 4 <= n - 1; c += 4)
+   {
+      __m256d centre = _mm256_loadu_pd(mid + c);
+      __m256d sum = _mm256_add_pd(_mm256_loadu_pd(up + c), _mm256_loadu_pd(down + c));
+      sum = _mm256_add_pd(sum, _mm256_loadu_pd(mid + c - 1));
+      sum = _mm256_add_pd(sum, _mm256_loadu_pd(mid + c + 1));
+      sum = _mm256_mul_pd(quarter, sum);
+      _mm256_storeu_pd(out + c, sum);
+      vdiff = _mm256_max_pd(vdiff, _mm256_andnot_pd(sign, _mm256_sub_pd(sum, centre)));
+   }
+   _mm256_storeu_pd(lanes, vdiff);
+   diff = MAX(MAX(lanes[0], lanes[1]), MAX(lanes[2], lanes[3]));
+   ROW_TAIL(c, n, diff);
+   return diff;
+}
+
+__attribute__((target("avx512f")))
+double row_avx512(const double *up, const double *mid, const double *down, double *out, int n)
+{
+   const __m512d quarter = _mm512_set1_pd(0.25);
+   __m512d vdiff = _mm512_setzero_pd();
+   double diff;
+   int c = 1;
+
+   for (; c + 8 <= n - 1; c += 8)
+   {
+      __m512d centre = _mm512_loadu_pd(mid + c);
+      __m512d sum = _mm512_add_pd(_mm512_loadu_pd(up + c), _mm512_loadu_pd(down + c));
+      sum = _mm512_add_pd(sum, _mm512_loadu_pd(mid + c - 1));
+      sum = _mm512_add_pd(sum, _mm512_loadu_pd(mid + c + 1));
+      sum = _mm512_mul_pd(quarter, sum);
+      _mm512_storeu_pd(out + c, sum);
+      vdiff = _mm512_max_pd(vdiff, _mm512_abs_pd(_mm512_sub_pd(sum, centre)));
+   }
+   diff = _mm512_reduce_max_pd(vdiff);
+   ROW_TAIL(c, n, diff);
+   return diff;
+}
+#endif
+
+/* Float storage kernel with arithmetic in calc_t (float, or double for --precision mixed) on vectors of
+   LANES values: WIDEN turns a vector of floats into calc_t and NARROW rounds it back for the store, the
+   change is taken between stored values in calc_t and VMAX folds it into the running maximum */
+#define ROW_FLOAT_KERNEL(name, calc_t, LANES, WIDEN, NARROW, VMAX, attr)                          \
+   attr double name(const float *up, const float *mid, const float *down, float *out, int n)      \
+   {                                                                                              \
+      typedef float vs __attribute__((vector_size(LANES * sizeof(float))));                       \
+      typedef calc_t vc __attribute__((vector_size(LANES * sizeof(calc_t))));                     \
+      typedef __typeof__((vc){} > (vc){}) vm;                                                     \
+      const vm magnitude = ~(vm)(-(vc){});                                                        \
+      vc vdiff = {}, sum, d;                                                                      \
+      vs a, b, l, r, centre;                                                                      \
+      calc_t diff = 0, x;                                                                         \
+      int c = 1;                                                                                  \
+                                                                                                  \
+      for (; c + LANES <= n - 1; c += LANES)                                                      \
+      {                                                                                           \
+         memcpy(&a, up + c, sizeof(vs));                                                          \
+         memcpy(&b, down + c, sizeof(vs));                                                        \
+         memcpy(&l, mid + c - 1, sizeof(vs));                                                     \
+         memcpy(&r, mid + c + 1, sizeof(vs));                                                     \
+         memcpy(&centre, mid + c, sizeof(vs));                                                    \
+         sum = WIDEN(a) + WIDEN(b);                                                               \
+         sum = sum + WIDEN(l);                                                                    \
+         sum = (calc_t)0.25 * (sum + WIDEN(r));                                                   \
+         a = NARROW(sum);                                                                         \
+         memcpy(out + c, &a, sizeof(vs));                                                         \
+         d = WIDEN(a) - WIDEN(centre);                                                            \
+         d = (vc)((vm)d & magnitude);                                                             \
+         vdiff = VMAX(vdiff, d);                                                                  \
+      }                                                                                           \
+      for (int i = 0; i < LANES; i++)                                                             \
+         diff = MAX(diff, vdiff[i]);                                                              \
+      for (; c < n - 1; c++)                                                                      \
+      {                                                                                           \
+         out[c] = (float)((calc_t)0.25 * ((calc_t)up[c] + (calc_t)down[c] + (calc_t)mid[c - 1] +  \
+                                          (calc_t)mid[c + 1]));                                   \
+         x = (calc_t)out[c] - (calc_t)mid[c];                                                     \
+         x = x < 0 ? -x : x;                                                                      \
+         diff = MAX(diff, x);                                                                     \
+      }                                                                                           \
+      return diff;                                                                                \
+   }
+
+#define VEC_SAME(v) (v)
+#define VEC_WIDEN(v) __builtin_convertvector(v, vc)
+#define VEC_NARROW(v) __builtin_convertvector(v, vs)
+/* Compare and select: no -ffast-math needed to vectorize it */
+#define VEC_MAX(a, b) ((vc)((((a) > (b)) & (vm)(a)) | (~((a) > (b)) & (vm)(b))))
+
+/* 16-byte vectors, SSE2 on x86-64 and whatever the target has elsewhere */
+ROW_FLOAT_KERNEL(row_float_generic, float, 4, VEC_SAME, VEC_SAME, VEC_MAX, )
+ROW_FLOAT_KERNEL(row_mixed_generic, double, 2, VEC_WIDEN, VEC_NARROW, VEC_MAX, )
+#if defined(__x86_64__) || defined(__i386__)
+/* GCC 12 splits __builtin_convertvector between float and double into halves, vcvtps2pd and vcvtpd2ps
+   do the whole vector */
+#define VEC_WIDEN_AVX2(v) ((vc)_mm256_cvtps_pd((__m128)(v)))
+#define VEC_NARROW_AVX2(v) ((vs)_mm256_cvtpd_ps((__m256d)(v)))
+#define VEC_WIDEN_AVX512(v) ((vc)_mm512_cvtps_pd((__m256)(v)))
+#define VEC_NARROW_AVX512(v) ((vs)_mm512_cvtpd_ps((__m512d)(v)))
+#define VEC_MAX_PS_AVX2(a, b) ((vc)_mm256_max_ps((__m256)(a), (__m256)(b)))
+#define VEC_MAX_PD_AVX2(a, b) ((vc)_mm256_max_pd((__m256d)(a), (__m256d)(b)))
+#define VEC_MAX_PS_AVX512(a, b) ((vc)_mm512_max_ps((__m512)(a), (__m512)(b)))
+#define VEC_MAX_PD_AVX512(a, b) ((vc)_mm512_max_pd((__m512d)(a), (__m512d)(b)))
+
+ROW_FLOAT_KERNEL(row_float_avx2, float, 8, VEC_SAME, VEC_SAME, VEC_MAX_PS_AVX2, __attribute__((target("avx2"))))
+ROW_FLOAT_KERNEL(row_mixed_avx2, double, 4, VEC_WIDEN_AVX2, VEC_NARROW_AVX2, VEC_MAX_PD_AVX2,
+                 __attribute__((target("avx2"))))
+ROW_FLOAT_KERNEL(row_float_avx512, float, 16, VEC_SAME, VEC_SAME, VEC_MAX_PS_AVX512,
+                 __attribute__((target("avx512f"))))
+ROW_FLOAT_KERNEL(row_mixed_avx512, double, 8, VEC_WIDEN_AVX512, VEC_NARROW_AVX512, VEC_MAX_PD_AVX512,
+                 __attribute__((target("avx512f"))))
+#endif
+
+/* Pick the row kernel from --kernel, or the widest one the CPU supports */
+void select_kernel(void)
+{
+   const char *want = kernel_name ? kernel_name : "auto";
+   int is_auto = strcmp(want, "auto") == 0;
+
+   row_kernel = row_scalar;
+   row_stencil = stencil_scalar;
+   kernel_name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_cpu_init();
+   if ((is_auto || strcmp(want, "avx512") == 0) && __builtin_cpu_supports("avx512f"))
+   {
+      row_kernel = row_avx512;
+      row_stencil = stencil_avx512;
+      kernel_name = "avx512";
+   }
+   else if ((is_auto || strcmp(want, "avx2") == 0) && __builtin_cpu_supports("avx2"))
+   {
+      row_kernel = row_avx2;
+      row_stencil = stencil_avx2;
+      kernel_name = "avx2";
+   }
+   else if ((is_auto || strcmp(want, "sse2") == 0) && __builtin_cpu_supports("sse2"))
+   {
+      row_kernel = row_sse2;
+      row_stencil = stencil_sse2;
+      kernel_name = "sse2";
+   }
+#endif
+   if (!is_auto && strcmp(want, kernel_name) != 0)
+      printf("Kernel %s is not available on this CPU, using %s\n", want, kernel_name);
+
+   /* The float kernel of the same width */
+   row_float = precision == PREC_MIXED ? row_mixed_generic : row_float_generic;
+#if defined(__x86_64__) || defined(__i386__)
+   if (strcmp(kernel_name, "avx512") == 0)
+      row_float = precision == PREC_MIXED ? row_mixed_avx512 : row_float_avx512;
+   else if (strcmp(kernel_name, "avx2") == 0)
+      row_float = precision == PREC_MIXED ? row_mixed_avx2 : row_float_avx2;
+#endif
+}
+
+/* Compute rows rb..re, columns cb..ce of dst from src, no diff */
+void stencil_block(double **src, double **dst, int rb, int re, int cb, int ce)
+{
+   for (int r = rb; r <= re; r++)
+      row_stencil(src[r - 1] + cb - 1, src[r] + cb - 1, src[r + 1] + cb - 1, dst[r] + cb - 1, ce - cb + 3);
+}
+
+/* Compute rows rb..re, columns cb..ce of dst from src, return the maximum change */
+double sweep_block(double **src, double **dst, int rb, int re, int cb, int ce)
+{
+   double diff = 0.0, d;
+
+   for (int r = rb; r <= re; r++)
+   {
+      d = row_kernel(src[r - 1] + cb - 1, src[r] + cb - 1, src[r + 1] + cb - 1, dst[r] + cb - 1, ce - cb + 3);
+      if (d > diff)
+         diff = d;
+   }
+   return diff;
+}
+
+/* Compute rows begin_r..end_r of dst from src, return the maximum change */
+double sweep_rows(double **src, double **dst, int begin_r, int end_r)
+{
+   return sweep_block(src, dst, begin_r, end_r, 1, N - 2);
+}
+
+/* First and last interior row of a worker */
+void worker_rows(int worker_id, int *begin_r, int *end_r)
+{
+   *begin_r = (int)(worker_id * M / thr_count);
+   *end_r = (int)((worker_id + 1) * M / thr_count - 1);
+   if (worker_id == 0)
+      (*begin_r)++;
+   if (worker_id == (thr_count - 1))
+      (*end_r)--;
+}
+
+/* Interior block of a worker: its row strip, or its cell of the blk_rows x blk_cols grid */
+void worker_block(int worker_id, int *rb, int *re, int *cb, int *ce)
+{
+   int i = worker_id / blk_cols, j = worker_id % blk_cols;
+
+   if (!decomp_blocks)
+   {
+      worker_rows(worker_id, rb, re);
+      *cb = 1;
+      *ce = N - 2;
+      return;
+   }
+   *rb = 1 + i * (M - 2) / blk_rows;
+   *re = (i + 1) * (M - 2) / blk_rows;
+   *cb = 1 + j * (N - 2) / blk_cols;
+   *ce = (j + 1) * (N - 2) / blk_cols;
+}
+
+/* The block of a worker widened to the grid border where it touches it, so the
+   workers' extended blocks cover the whole grid exactly once */
+void worker_extent(int worker_id, int *r0, int *r1, int *c0, int *c1)
+{
+   worker_block(worker_id, r0, r1, c0, c1);
+   if (*r0 == 1)
+      *r0 = 0;
+   if (*r1 == M - 2)
+      *r1 = M - 1;
+   if (*c0 == 1)
+      *c0 = 0;
+   if (*c1 == N - 2)
+      *c1 = N - 1;
+}
+
+/* Cache size from sysconf, or the fallback when the C library does not know it */
+long cache_size(int name, long fallback)
+{
+   long size = sysconf(name);
+
+   return size > 0 ? size : fallback;
+}
+
+/* Blocks per column and row for the thread count: the factorization with the smallest block perimeter */
+void choose_blocks(void)
+{
+   double best = -1.0, cost;
+
+   for (int p = 1; p <= thr_count; p++)
+   {
+      if (thr_count % p || p > M - 2 || thr_count / p > N - 2)
+         continue;
+      cost = (double)(M - 2) / p + (double)(N - 2) / (thr_count / p);
+      if (best < 0.0 || cost < best)
+      {
+         best = cost;
+         blk_rows = p;
+         blk_cols = thr_count / p;
+      }
+   }
+}
+
+/* Bind the calling worker to the worker_id-th CPU it is allowed to run on */
+void pin_worker(int worker_id)
+{
+   cpu_set_t allowed, one;
+   int k, cpu;
+
+   if (!pin_threads || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+      return;
+   k = worker_id % CPU_COUNT(&allowed);
+   for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &allowed) && k-- == 0)
+         break;
+   CPU_ZERO(&one);
+   CPU_SET(cpu, &one);
+   sched_setaffinity(0, sizeof(one), &one);
+}
+
+/* Timestamp for the instrumentation: the TSC on x86 (a few cycles), nanoseconds elsewhere */
+static inline uint64_t trace_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   return __rdtsc();
+#else
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+#endif
+}
+
+/* Phase boundary k of the current iteration of a worker */
+static inline void trace_mark(int worker_id, int k)
+{
+   if (instrument)
+      traces[worker_id].cur.t[k] = trace_now();
+}
+
+/* The iteration is over: keep it in the ring and add it to the totals */
+static inline void trace_commit(int worker_id, int its)
+{
+   trace_thread *tt;
+
+   if (!instrument)
+      return;
+   tt = &traces[worker_id];
+   tt->cur.its = its;
+   tt->ring[its & (TRACE_RING - 1)] = tt->cur;
+   for (int k = 0; k < 3; k++)
+      tt->sum[k] += tt->cur.t[k + 1] - tt->cur.t[k];
+   tt->iterations++;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_ia32_pause();
+#endif
+}
+
+void barrier_init(barrier_t *b, int n)
+{
+   atomic_init(&b->count, n);
+   atomic_init(&b->sense, 0);
+   atomic_init(&b->sleepers, 0);
+   b->total = n;
+   /* Spinning only pays when every thread has its own CPU */
+   b->spin = (n <= sysconf(_SC_NPROCESSORS_ONLN)) ? 20000 : 0;
+}
+
+/* Sense-reversing barrier: the last thread to arrive flips the sense,
+   the others spin on it for a while and then sleep on it with futex_wait */
+void barrier_wait(barrier_t *b, int *local_sense)
+{
+   int s = !*local_sense;
+   *local_sense = s;
+
+   if (atomic_fetch_sub(&b->count, 1) == 1)
+   {
+      atomic_store(&b->count, b->total);
+      atomic_store(&b->sense, s);
+      if (atomic_load(&b->sleepers) > 0)
+         syscall(SYS_futex, &b->sense, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+      return;
+   }
+
+   for (int i = 0; i < b->spin; i++)
+   {
+      if (atomic_load_explicit(&b->sense, memory_order_acquire) == s)
+         return;
+      cpu_relax();
+   }
+   atomic_fetch_add(&b->sleepers, 1);
+   while (atomic_load(&b->sense) != s)
+      syscall(SYS_futex, &b->sense, FUTEX_WAIT_PRIVATE, !s, NULL, NULL, 0);
+   atomic_fetch_sub(&b->sleepers, 1);
+}
+
+/* Copy rows begin_r..end_r, borders included */
+void copy_rows(double **from, double **to, int begin_r, int end_r)
+{
+   memcpy(to[begin_r], from[begin_r], (end_r - begin_r + 1) * N * sizeof(double));
+}
+
+/* Copy rows r0..r1, columns c0..c1 */
+void copy_block(double **from, double **to, int r0, int r1, int c0, int c1)
+{
+   for (int r = r0; r <= r1; r++)
+      memcpy(to[r] + c0, from[r] + c0, (c1 - c0 + 1) * sizeof(double));
+}
+
+/* Write (or read, if reading) rows r0..r1, columns c0..c1 of a grid at their place in a binary grid
+   file; whole rows go in one call. Return -1 on a short transfer */
+int grid_io(int fd, double **grid, int r0, int r1, int c0, int c1, int reading)
+{
+   size_t len = (c1 - c0 + 1) * sizeof(double);
+   int rows = 1;
+
+   if (c0 == 0 && c1 == N - 1)
+   {
+      len *= r1 - r0 + 1; /* Contiguous storage */
+      rows = r1 - r0 + 1;
+   }
+   for (int r = r0; r <= r1; r += rows)
+   {
+      off_t off = sizeof(grid_header) + ((off_t)r * N + c0) * sizeof(double);
+      ssize_t n = reading ? pread(fd, grid[r] + c0, len, off) : pwrite(fd, grid[r] + c0, len, off);
+
+      if (n != (ssize_t)len)
+         return -1;
+   }
+   return 0;
+}
+
+/* Open a binary grid file for writing: the size is set and the header written, the rows are
+   left to the writers */
+int grid_create(const char *path, long its, double diff)
+{
+   grid_header h;
+   int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+   if (fd < 0)
+      return -1;
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, GRID_MAGIC, 8);
+   h.version = 1;
+   h.rows = M;
+   h.cols = N;
+   h.iterations = its;
+   h.diff = diff;
+   if (ftruncate(fd, sizeof(h) + (off_t)M * N * sizeof(double)) != 0 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+   {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+/* Open a binary grid file for reading and check its header against M x N (if rows > 0) */
+int grid_open(const char *path, grid_header *h, int rows, int cols)
+{
+   int fd = open(path, O_RDONLY);
+
+   if (fd < 0)
+      return -1;
+   if (pread(fd, h, sizeof(*h), 0) != sizeof(*h) || memcmp(h->magic, GRID_MAGIC, 8) != 0 || h->version != 1 ||
+       (rows > 0 && (h->rows != (uint32_t)rows || h->cols != (uint32_t)cols)))
+   {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+typedef struct
+{
+   int fd, r0, r1, failed;
+   double **grid;
+} grid_writer;
+
+void *grid_writer_func(void *arg)
+{
+   grid_writer *gw = arg;
+
+   gw->failed = grid_io(gw->fd, gw->grid, gw->r0, gw->r1, 0, N - 1, 0);
+   return NULL;
+}
+
+/* Write a grid as a binary file, rows split across thr_count writer threads; started once the solve is
+   over rather than by the solver workers, which leave the final grid in u or w depending on the scheme */
+void write_binary(char *path, double **grid, long its, double diff)
+{
+   int fd = grid_create(path, its, diff), i, failed = 0;
+   pthread_t *threads = malloc(thr_count * sizeof(pthread_t));
+   grid_writer *gw = malloc(thr_count * sizeof(grid_writer));
+
+   if (fd < 0)
+   {
+      printf("Can't open output file.");
+      exit(-1);
+   }
+   for (i = 0; i < thr_count; i++)
+   {
+      gw[i].fd = fd;
+      gw[i].grid = grid;
+      gw[i].r0 = (int)((long)i * M / thr_count);
+      gw[i].r1 = (int)((long)(i + 1) * M / thr_count - 1);
+      pthread_create(&threads[i], NULL, grid_writer_func, &gw[i]);
+   }
+   for (i = 0; i < thr_count; i++)
+   {
+      pthread_join(threads[i], NULL);
+      failed |= gw[i].failed;
+   }
+   if (close(fd) != 0 || failed)
+   {
+      printf("Can't write output file.");
+      exit(-1);
+   }
+   free(threads);
+   free(gw);
+}
+
+/* --to-text: print a binary grid file with print_solution() into <path>.dat */
+int convert_to_text(char *path)
+{
+   void print_solution(char *, double **);
+   grid_header h;
+   int fd = grid_open(path, &h, 0, 0);
+   size_t len;
+   char *map, *out;
+   double **rows;
+
+   if (fd < 0)
+   {
+      printf("%s is not a binary grid file\n", path);
+      return -1;
+   }
+   M = h.rows;
+   N = h.cols;
+   len = sizeof(h) + (size_t)M * N * sizeof(double);
+   map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+   {
+      printf("Can't map %s\n", path);
+      return -1;
+   }
+   rows = malloc(M * sizeof(double *));
+   for (int i = 0; i < M; i++)
+      rows[i] = (double *)(map + sizeof(h)) + (size_t)i * N;
+   out = malloc(strlen(path) + 5);
+   sprintf(out, "%s.dat", path);
+   print_solution(out, rows);
+   printf("%s: %dx%d grid after %ld iterations (error %8.6f) written to %s\n", path, M, N, (long)h.iterations,
+          h.diff, out);
+   munmap(map, len);
+   free(rows);
+   free(out);
+   return 0;
+}
+
+/* Save src (the grid after iteration its) as the checkpoint: worker 0 creates a temporary file,
+   every worker writes its own block into it, and worker 0 makes it the checkpoint by rename */
+void write_checkpoint(int worker_id, double **src, int its, double diff, int *sense)
+{
+   int r0, r1, c0, c1;
+   char tmp[PATH_MAX];
+
+   snprintf(tmp, sizeof(tmp), "%s.tmp", checkpoint_path);
+   if (worker_id == 0)
+      checkpoint_fd = grid_create(tmp, its, diff);
+   barrier_wait(&bar, sense);
+   if (checkpoint_fd < 0)
+   {
+      if (worker_id == 0) /* Every worker sees the same failure, one reports it */
+         fprintf(stderr, "Checkpoint at iteration %d failed: can't create %s\n", its, tmp);
+      return;
+   }
+   worker_extent(worker_id, &r0, &r1, &c0, &c1);
+   if (grid_io(checkpoint_fd, src, r0, r1, c0, c1, 0) != 0)
+      atomic_fetch_add(&checkpoint_errors, 1);
+   barrier_wait(&bar, sense);
+   if (worker_id != 0)
+      return;
+   if (atomic_exchange(&checkpoint_errors, 0) != 0 || fsync(checkpoint_fd) != 0 || rename(tmp, checkpoint_path) != 0)
+      fprintf(stderr, "Checkpoint at iteration %d failed\n", its);
+   close(checkpoint_fd);
+}
+
+/* Start of every barrier worker: pin it, and under --first-touch initialize its part of u and w
+   (or under --restart read it from the checkpoint) before anyone reads them */
+void worker_start(int worker_id, int *sense)
+{
+   int r0, r1, c0, c1;
+
+   pin_worker(worker_id);
+   if (!first_touch && restart_fd < 0)
+      return;
+   worker_extent(worker_id, &r0, &r1, &c0, &c1);
+   if (restart_fd < 0)
+   {
+      initialize_block(u, r0, r1, c0, c1);
+      initialize_block(w, r0, r1, c0, c1);
+   }
+   else if (grid_io(restart_fd, u, r0, r1, c0, c1, 1) == 0)
+      copy_block(u, w, r0, r1, c0, c1);
+   else
+      atomic_fetch_add(&restart_errors, 1);
+   barrier_wait(&bar, sense);
+
+   /* A restart with a part missing must not carry on from the initial values: every worker sees the
+      count after the barrier, so all of them leave and worker 0 ends the program */
+   if (atomic_load(&restart_errors) != 0)
+   {
+      if (worker_id != 0)
+         pthread_exit(NULL);
+      printf("Cannot read the restart file: %d worker(s) failed\n", atomic_load(&restart_errors));
+      exit(-1);
+   }
+   if (restart_fd >= 0 && worker_id == 0)
+   {
+      close(restart_fd); /* Every worker has read its part before the barrier */
+      restart_fd = -1;
+   }
+}
+
+/* Iterations until the next check under --check-interval auto: the max diff of Jacobi never grows
+   and decays roughly geometrically, so extrapolate the rate between the last two checks and check
+   again about halfway to the predicted convergence (the replay after a hit stays short) */
+int next_interval(double diff, double last_diff, int apart, int interval)
+{
+   double rate, left;
+
+   if (last_diff <= 0.0 || diff >= last_diff)
+      return MIN(2 * interval, CHECK_MAX);
+   rate = pow(diff / last_diff, 1.0 / apart);
+   left = log(solve_params->epsilon / diff) / log(rate);
+   return (int)MAX(1.0, MIN(left / 2, (double)CHECK_MAX));
+}
+
+/* Rows of level l owned by a worker, empty (begin > end) when the level has fewer rows than threads */
+void level_rows(int l, int worker_id, int *begin_r, int *end_r)
+{
+   int inner = levels[l].rows - 2;
+
+   if (l == 0)
+   {
+      worker_rows(worker_id, begin_r, end_r);
+      return;
+   }
+   *begin_r = 1 + worker_id * inner / thr_count;
+   *end_r = (worker_id + 1) * inner / thr_count;
+}
+
+/* Relax the cells of one colour ((r + c) % 2 == colour) in rows begin_r..end_r of a level in place,
+   return the largest change. omega = 1 is Gauss-Seidel */
+double rb_half(mg_level *lv, int colour, int begin_r, int end_r, double omega)
+{
+   double **u = lv->u, **f = lv->f;
+   double ar = lv->ar, ac = lv->ac, centre = 2 * (ar + ac), diff = 0.0, gs, delta;
+
+   for (int r = begin_r; r <= end_r; r++)
+   {
+      for (int c = 1 + ((r + 1 + colour) & 1); c < lv->cols - 1; c += 2)
+      {
+         gs = (ar * (u[r - 1][c] + u[r + 1][c]) + ac * (u[r][c - 1] + u[r][c + 1]) + (f ? f[r][c] : 0.0)) / centre;
+         delta = omega * (gs - u[r][c]);
+         u[r][c] += delta;
+         if (fabs(delta) > diff)
+            diff = fabs(delta);
+      }
+   }
+   return diff;
+}
+
+/* One red-black sweep of a level by every worker; this worker's largest change goes to slot (if any)
+   before the closing barrier, so every worker can reduce the slots right after it */
+void rb_sweep(mg_level *lv, int begin_r, int end_r, double omega, int *sense, double *slot)
+{
+   double diff = rb_half(lv, 0, begin_r, end_r, omega), black;
+
+   barrier_wait(&bar, sense);
+   black = rb_half(lv, 1, begin_r, end_r, omega);
+   diff = MAX(diff, black);
+   if (slot)
+      *slot = diff;
+   barrier_wait(&bar, sense);
+}
+
+/* Entry function of the worker threads for red-black SOR: the red cells only read black ones and
+   the other way round, so each colour is swept in place by all workers between two barriers */
+void *thr_func_sor(void *arg)
+{
+   int worker_id = *(int *)arg;
+   int begin_r, end_r, its, t;
+   int sense = 0;
+   double diff = 0.0;
+   struct rusage thr_usage;
+
+   worker_start(worker_id, &sense);
+   worker_rows(worker_id, &begin_r, &end_r);
+   for (its = 1; its <= max_its; its++)
+   {
+      rb_sweep(&levels[0], begin_r, end_r, omega, &sense, &diff_slot[(its & 1) * thr_count + worker_id].v);
+
+      diff = 0.0;
+      for (t = 0; t < thr_count; t++)
+         diff = MAX(diff, diff_slot[(its & 1) * thr_count + t].v);
+
+      /* Terminate if temperatures have converged */
+      if (diff <= solve_params->epsilon)
+         break;
+   }
+   copy_rows(u, w, begin_r, end_r); /* In place: w ends equal to u */
+
+   if (worker_id == 0)
+   {
+      barrier_its = its;
+      max_diff = diff;
+   }
+
+   getrusage(RUSAGE_THREAD, &thr_usage);
+   stat[worker_id][0] = thr_usage.ru_utime.tv_sec + thr_usage.ru_utime.tv_usec / 1000000.0;
+   stat[worker_id][1] = thr_usage.ru_stime.tv_sec + thr_usage.ru_stime.tv_usec / 1000000.0;
+   return NULL;
+}
+
+/* Position of fine index i on the coarse grid of a dimension with n fine and nc coarse points,
+   as the coarse cell k and the fraction a inside it (the grids need not be nested) */
+void coarse_pos(int i, int n, int nc, int *k, double *a)
+{
+   double t = (double)i * (nc - 1) / (n - 1);
+
+   *k = MIN((int)t, nc - 2);
+   *a = t - *k;
+}
+
+/* Residual of level l in rows begin_r..end_r */
+void mg_residual(mg_level *lv, int begin_r, int end_r)
+{
+   double **u = lv->u, **f = lv->f;
+   double ar = lv->ar, ac = lv->ac, centre = 2 * (ar + ac);
+
+   for (int r = begin_r; r <= end_r; r++)
+      for (int c = 1; c < lv->cols - 1; c++)
+         lv->r[r][c] = (f ? f[r][c] : 0.0) - centre * u[r][c] + ar * (u[r - 1][c] + u[r + 1][c]) +
+                       ac * (u[r][c - 1] + u[r][c + 1]);
+}
+
+/* Right-hand side of coarse rows begin_r..end_r: the fine residual averaged with the bilinear
+   weights of the interpolation (the transpose of prolongation, normalized), and zero correction */
+void mg_restrict(mg_level *fine, mg_level *coarse, int begin_r, int end_r)
+{
+   double sr = (double)(fine->rows - 1) / (coarse->rows - 1), sc = (double)(fine->cols - 1) / (coarse->cols - 1);
+
+   for (int R = begin_r; R <= end_r; R++)
+   {
+      int i0 = MAX(0, (int)ceil((R - 1) * sr)), i1 = MIN(fine->rows - 1, (int)floor((R + 1) * sr));
+
+      memset(coarse->u[R], 0, coarse->cols * sizeof(double));
+      for (int C = 1; C < coarse->cols - 1; C++)
+      {
+         int j0 = MAX(0, (int)ceil((C - 1) * sc)), j1 = MIN(fine->cols - 1, (int)floor((C + 1) * sc));
+         double sum = 0.0, weight = 0.0, wi, wj;
+
+         for (int i = i0; i <= i1; i++)
+         {
+            wi = 1.0 - fabs(i / sr - R);
+            if (wi <= 0.0)
+               continue;
+            for (int j = j0; j <= j1; j++)
+            {
+               wj = 1.0 - fabs(j / sc - C);
+               if (wj <= 0.0)
+                  continue;
+               sum += wi * wj * fine->r[i][j];
+               weight += wi * wj;
+            }
+         }
+         coarse->f[R][C] = weight > 0.0 ? sum / weight : 0.0;
+      }
+   }
+}
+
+/* Add the bilinear interpolation of the coarse correction to fine rows begin_r..end_r */
+void mg_prolong(mg_level *coarse, mg_level *fine, int begin_r, int end_r)
+{
+   double **e = coarse->u, a, b;
+   int k, l;
+
+   for (int r = begin_r; r <= end_r; r++)
+   {
+      coarse_pos(r, fine->rows, coarse->rows, &k, &a);
+      for (int c = 1; c < fine->cols - 1; c++)
+      {
+         coarse_pos(c, fine->cols, coarse->cols, &l, &b);
+         fine->u[r][c] += (1 - a) * ((1 - b) * e[k][l] + b * e[k][l + 1]) + a * ((1 - b) * e[k + 1][l] + b * e[k + 1][l + 1]);
+      }
+   }
+}
+
+/* One V-cycle by every worker, rows of every level partitioned like the fine grid */
+void mg_vcycle(int worker_id, int *sense)
+{
+   int l, b, e, s;
+
+   for (l = 0; l < nlevels - 1; l++)
+   {
+      level_rows(l, worker_id, &b, &e);
+      for (s = 0; s < MG_PRE; s++)
+         rb_sweep(&levels[l], b, e, 1.0, sense, NULL);
+      mg_residual(&levels[l], b, e);
+      barrier_wait(&bar, sense);
+      level_rows(l + 1, worker_id, &b, &e);
+      mg_restrict(&levels[l], &levels[l + 1], b, e);
+      barrier_wait(&bar, sense);
+   }
+   level_rows(l, worker_id, &b, &e);
+   for (s = 0; s < MG_COARSEST; s++)
+      rb_sweep(&levels[l], b, e, 1.0, sense, NULL);
+   for (l = nlevels - 2; l >= 0; l--)
+   {
+      level_rows(l, worker_id, &b, &e);
+      mg_prolong(&levels[l + 1], &levels[l], b, e);
+      barrier_wait(&bar, sense);
+      for (s = 0; s < MG_POST; s++)
+         rb_sweep(&levels[l], b, e, 1.0, sense, NULL);
+   }
+}
+
+/* Entry function of the worker threads for multigrid: an iteration is a V-cycle, w keeps the grid
+   before it so the change of the whole cycle is compared with the termination condition */
+void *thr_func_mg(void *arg)
+{
+   int worker_id = *(int *)arg;
+   int begin_r, end_r, its, t, r, c;
+   int sense = 0;
+   double diff = 0.0, mine;
+   struct rusage thr_usage;
+
+   worker_start(worker_id, &sense);
+   worker_rows(worker_id, &begin_r, &end_r);
+   for (its = 1; its <= max_its; its++)
+   {
+      copy_rows(u, w, begin_r, end_r);
+      mg_vcycle(worker_id, &sense);
+
+      mine = 0.0;
+      for (r = begin_r; r <= end_r; r++)
+         for (c = 1; c < N - 1; c++)
+            mine = MAX(mine, fabs(u[r][c] - w[r][c]));
+      diff_slot[(its & 1) * thr_count + worker_id].v = mine;
+      barrier_wait(&bar, &sense);
+
+      diff = 0.0;
+      for (t = 0; t < thr_count; t++)
+         diff = MAX(diff, diff_slot[(its & 1) * thr_count + t].v);
+
+      /* Terminate if temperatures have converged */
+      if (diff <= solve_params->epsilon)
+         break;
+   }
+
+   if (worker_id == 0)
+   {
+      barrier_its = its;
+      max_diff = diff;
+   }
+
+   getrusage(RUSAGE_THREAD, &thr_usage);
+   stat[worker_id][0] = thr_usage.ru_utime.tv_sec + thr_usage.ru_utime.tv_usec / 1000000.0;
+   stat[worker_id][1] = thr_usage.ru_stime.tv_sec + thr_usage.ru_stime.tv_usec / 1000000.0;
+   return NULL;
+}
+
+/* Build the level hierarchy over u: every dimension is halved until it has MG_MIN points or fewer */
+void mg_setup(void)
+{
+   void allocate_2d_array(int, int, double ***);
+   int rows = M, cols = N, l;
+
+   for (nlevels = 1; rows > MG_MIN || cols > MG_MIN; nlevels++)
+   {
+      rows = rows > MG_MIN ? (rows - 1) / 2 + 1 : rows;
+      cols = cols > MG_MIN ? (cols - 1) / 2 + 1 : cols;
+   }
+   if (solver != SOLVER_MG)
+      nlevels = 1;
+   levels = calloc(nlevels, sizeof(mg_level));
+   rows = M;
+   cols = N;
+   for (l = 0; l < nlevels; l++)
+   {
+      mg_level *lv = &levels[l];
+
+      lv->rows = rows;
+      lv->cols = cols;
+      lv->ar = pow((double)(rows - 1) / (M - 1), 2);
+      lv->ac = pow((double)(cols - 1) / (N - 1), 2);
+      if (l == 0)
+         lv->u = u;
+      else
+      {
+         allocate_2d_array(rows, cols, &lv->u);
+         allocate_2d_array(rows, cols, &lv->f);
+         memset(lv->u[0], 0, rows * cols * sizeof(double));
+      }
+      if (l < nlevels - 1)
+      {
+         allocate_2d_array(rows, cols, &lv->r);
+         memset(lv->r[0], 0, rows * cols * sizeof(double));
+      }
+      rows = rows > MG_MIN ? (rows - 1) / 2 + 1 : rows;
+      cols = cols > MG_MIN ? (cols - 1) / 2 + 1 : cols;
+   }
+}
+
+void mg_free(void)
+{
+   for (int l = 0; l < nlevels; l++)
+   {
+      if (l > 0)
+      {
+         free(levels[l].u[0]);
+         free(levels[l].u);
+         free(levels[l].f[0]);
+         free(levels[l].f);
+      }
+      if (levels[l].r)
+      {
+         free(levels[l].r[0]);
+         free(levels[l].r);
+      }
+   }
+   free(levels);
+}
+
+/* SOR factor for the model problem: from the spectral radius of Jacobi on a rows x cols grid */
+double optimal_omega(int rows, int cols)
+{
+   double rho = (cos(M_PI / (rows - 1)) + cos(M_PI / (cols - 1))) / 2;
+
+   return 2.0 / (1.0 + sqrt(1.0 - rho * rho));
+}
+
+/* Defaults of the assignment: 200x200, 0 degrees around, 1000 at the bottom, 25 inside */
+void heat_params_default(heat_params *p)
+{
+   p->rows = 200;
+   p->cols = 200;
+   p->top = p->left = p->right = 0.0;
+   p->bottom = 1000.0;
+   p->initial = 25.0;
+   p->epsilon = EPSILON;
+   p->max_its = 1000000;
+   p->solver = SOLVER_JACOBI;
+   p->omega = 0.0;
+   p->threads = 0;
+}
+
+/* Check the parameters and pick the SOR factor when it is left to the grid; 0 if they are unusable
+   (multigrid needs the workers) */
+int heat_resolve(heat_params *p)
+{
+   if (p->rows < 3 || p->cols < 3 || p->max_its < 1 ||
+       (p->solver != SOLVER_JACOBI && p->solver != SOLVER_SOR && !(p->solver == SOLVER_MG && p->threads > 0)))
+      return 0;
+   if (p->solver == SOLVER_SOR && p->omega == 0.0)
+      p->omega = optimal_omega(p->rows, p->cols);
+   return 1;
+}
+
+/* Allocate and initialize a solver context, NULL if the parameters are unusable */
+heat_ctx *heat_create(const heat_params *p)
+{
+   void allocate_2d_array(int, int, double ***);
+   heat_ctx *ctx = calloc(1, sizeof(heat_ctx));
+
+   ctx->p = *p;
+   if (!heat_resolve(&ctx->p))
+   {
+      free(ctx);
+      return NULL;
+   }
+   allocate_2d_array(p->rows, p->cols, &ctx->u);
+   allocate_2d_array(p->rows, p->cols, &ctx->w);
+   if (p->threads > 0 && (first_touch || restart_fd >= 0 || precision != PREC_DOUBLE))
+      return ctx; /* The workers touch their own parts first (or read them from the checkpoint) */
+   for (int i = 0; i < p->rows; i++)
+      for (int j = 0; j < p->cols; j++)
+         ctx->u[i][j] = ctx->w[i][j] = initial_value(p, i, j);
+   return ctx;
+}
+
+/* Solve a context, return the iteration count: in the calling thread, or with p.threads > 0 on the
+   workers of find_steady_state with every command-line option (the workers take the grid from the
+   context through solve_params, but u and w are global, so one such solve at a time) */
+int heat_solve(heat_ctx *ctx)
+{
+   int find_steady_state(void);
+   heat_params *p = &ctx->p;
+   double **src = ctx->u, **dst = ctx->w, **temp, diff = 0.0, d;
+   int its;
+
+   if (p->threads > 0)
+   {
+      M = p->rows;
+      N = p->cols;
+      thr_count = p->threads;
+      solver = p->solver;
+      omega = p->omega;
+      max_its = p->max_its;
+      solve_params = p;
+      u = ctx->u;
+      w = ctx->w;
+      ctx->its = find_steady_state();
+      ctx->u = u;
+      ctx->w = w;
+      ctx->diff = final_diff;
+      return ctx->its;
+   }
+
+   for (its = 1; its <= p->max_its; its++)
+   {
+      diff = 0.0;
+      if (p->solver == SOLVER_SOR)
+      {
+         mg_level lv = {p->rows, p->cols, 1.0, 1.0, src, NULL, NULL};
+
+         diff = rb_half(&lv, 0, 1, p->rows - 2, p->omega);
+         d = rb_half(&lv, 1, 1, p->rows - 2, p->omega);
+         diff = MAX(diff, d);
+      }
+      else
+      {
+         for (int r = 1; r < p->rows - 1; r++)
+         {
+            d = row_kernel(src[r - 1], src[r], src[r + 1], dst[r], p->cols);
+            diff = MAX(diff, d);
+         }
+         /* Swap matrix u, w by exchanging the pointers */
+         temp = src;
+         src = dst;
+         dst = temp;
+      }
+
+      /* Terminate if temperatures have converged */
+      if (diff <= p->epsilon)
+         break;
+   }
+   ctx->u = src;
+   ctx->w = dst;
+   ctx->its = its;
+   ctx->diff = diff;
+   return its;
+}
+
+void heat_destroy(heat_ctx *ctx)
+{
+   if (solve_params == &ctx->p)
+      solve_params = &grid_params;
+   free(ctx->u[0]);
+   free(ctx->w[0]);
+   free(ctx->u);
+   free(ctx->w);
+   free(ctx);
+}
+
+/* Pool thread: solve queued contexts until the pool stops */
+void *heat_pool_thread(void *arg)
+{
+   heat_pool *pool = arg;
+   heat_ctx *ctx;
+
+   pthread_mutex_lock(&pool->lock);
+   for (;;)
+   {
+      while (!pool->head && !pool->stop)
+         pthread_cond_wait(&pool->work, &pool->lock);
+      if (!pool->head)
+         break;
+      ctx = pool->head;
+      pool->head = ctx->next;
+      if (!pool->head)
+         pool->tail = NULL;
+      pool->busy++;
+      pthread_mutex_unlock(&pool->lock);
+
+      heat_solve(ctx);
+
+      pthread_mutex_lock(&pool->lock);
+      if (--pool->busy == 0 && !pool->head)
+         pthread_cond_broadcast(&pool->idle);
+   }
+   pthread_mutex_unlock(&pool->lock);
+   return NULL;
+}
+
+/* A pool of threads shared by every context submitted to it, each context solved by one thread */
+heat_pool *heat_pool_create(int threads)
+{
+   heat_pool *pool = calloc(1, sizeof(heat_pool));
+
+   pool->count = threads;
+   pool->threads = malloc(threads * sizeof(pthread_t));
+   pthread_mutex_init(&pool->lock, NULL);
+   pthread_cond_init(&pool->work, NULL);
+   pthread_cond_init(&pool->idle, NULL);
+   for (int i = 0; i < threads; i++)
+      pthread_create(&pool->threads[i], NULL, heat_pool_thread, pool);
+   return pool;
+}
+
+void heat_pool_submit(heat_pool *pool, heat_ctx *ctx)
+{
+   pthread_mutex_lock(&pool->lock);
+   ctx->next = NULL;
+   if (pool->tail)
+      pool->tail->next = ctx;
+   else
+      pool->head = ctx;
+   pool->tail = ctx;
+   pthread_cond_signal(&pool->work);
+   pthread_mutex_unlock(&pool->lock);
+}
+
+/* Wait until every submitted context is solved */
+void heat_pool_wait(heat_pool *pool)
+{
+   pthread_mutex_lock(&pool->lock);
+   while (pool->head || pool->busy)
+      pthread_cond_wait(&pool->idle, &pool->lock);
+   pthread_mutex_unlock(&pool->lock);
+}
+
+void heat_pool_destroy(heat_pool *pool)
+{
+   pthread_mutex_lock(&pool->lock);
+   pool->stop = 1;
+   pthread_cond_broadcast(&pool->work);
+   pthread_mutex_unlock(&pool->lock);
+   for (int i = 0; i < pool->count; i++)
+      pthread_join(pool->threads[i], NULL);
+   pthread_mutex_destroy(&pool->lock);
+   pthread_cond_destroy(&pool->work);
+   pthread_cond_destroy(&pool->idle);
+   free(pool->threads);
+   free(pool);
+}
+
+/* --batch FILE: one grid per line, "rows cols [top bottom left right [initial]]" (# starts a comment,
+   missing values come from the command line), all solved on a pool of thr_count threads */
+int run_batch(char *path)
+{
+   FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+   heat_ctx **ctxs = NULL;
+   heat_pool *pool;
+   char line[512];
+   int count = 0, cap = 0, lineno = 0, i, r, c;
+   struct timespec t0, t1;
+   double elapsed, mean;
+
+   if (!in)
+   {
+      printf("Can't open %s\n", path);
+      return -1;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   pool = heat_pool_create(thr_count);
+   while (fgets(line, sizeof(line), in))
+   {
+      heat_params p = grid_params;
+      char *hash = strchr(line, '#');
+      int n;
+
+      lineno++;
+      if (hash)
+         *hash = '\0';
+      n = sscanf(line, "%d %d %lf %lf %lf %lf %lf", &p.rows, &p.cols, &p.top, &p.bottom, &p.left, &p.right,
+                 &p.initial);
+      if (n <= 0)
+         continue;
+      if (n == 1)
+         p.cols = p.rows;
+      if (count == cap)
+      {
+         cap = cap ? 2 * cap : 64;
+         ctxs = realloc(ctxs, cap * sizeof(heat_ctx *));
+      }
+      if (!(ctxs[count] = heat_create(&p)))
+      {
+         printf("%s:%d: bad grid\n", path, lineno);
+         continue;
+      }
+      heat_pool_submit(pool, ctxs[count++]);
+   }
+   if (in != stdin)
+      fclose(in);
+   heat_pool_wait(pool);
+   heat_pool_destroy(pool);
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+   for (i = 0; i < count; i++)
+   {
+      heat_ctx *ctx = ctxs[i];
+
+      mean = 0.0;
+      for (r = 0; r < ctx->p.rows; r++)
+         for (c = 0; c < ctx->p.cols; c++)
+            mean += ctx->u[r][c];
+      mean /= (double)ctx->p.rows * ctx->p.cols;
+      printf("Grid %d: %dx%d converged after %d iterations with error: %8.6f, mean temperature %.4f\n", i + 1,
+             ctx->p.rows, ctx->p.cols, ctx->its, ctx->diff, mean);
+      heat_destroy(ctx);
+   }
+   printf("%d grids in %.4f sec (%.1f grids/sec) on %d threads\n", count, elapsed, count / elapsed, thr_count);
+   free(ctxs);
+   return 0;
+}
+
+/* Entry function of the worker threads in the barrier scheme:
+   every worker reduces the per-thread slots itself after the barrier, so one barrier per iteration is enough
+   (the slots are double-buffered by parity, a fast worker cannot overwrite a slot still being read) */
+void *thr_func_barrier(void *arg)
+{
+   int worker_id = *(int *)arg;
+   int begin_r, end_r, begin_c, end_c, its, t, sense = 0;
+   int r0, r1, c0, c1;
+   double **src = u, **dst = w, **temp;
+   double diff = 0.0;
+   struct rusage thr_usage;
+
+   /* Sparse checks: the next check, the last check that had not converged (whose grid is in snap) */
+   int sparse = check_interval != 1, interval = check_interval ? check_interval : 1;
+   int next_check = restart_its + interval, last_check = restart_its;
+   double last_diff = 0.0;
+
+   worker_start(worker_id, &sense);
+   worker_block(worker_id, &begin_r, &end_r, &begin_c, &end_c);
+   worker_extent(worker_id, &r0, &r1, &c0, &c1);
+   if (sparse)
+      copy_block(src, snap, r0, r1, c0, c1);
+
+   for (its = restart_its + 1; its <= max_its; its++)
+   {
+      trace_mark(worker_id, 0);
+      if (sparse && its < next_check && its < max_its)
+      {
+         stencil_block(src, dst, begin_r, end_r, begin_c, end_c);
+         trace_mark(worker_id, 1);
+         barrier_wait(&bar, &sense);
+         trace_mark(worker_id, 2);
+         trace_mark(worker_id, 3);
+         trace_commit(worker_id, its);
+         temp = src;
+         src = dst;
+         dst = temp;
+         continue;
+      }
+
+      diff_slot[(its & 1) * thr_count + worker_id].v = sweep_block(src, dst, begin_r, end_r, begin_c, end_c);
+      trace_mark(worker_id, 1);
+
+      barrier_wait(&bar, &sense);
+      trace_mark(worker_id, 2);
+
+      diff = 0.0;
+      for (t = 0; t < thr_count; t++)
+         diff = MAX(diff, diff_slot[(its & 1) * thr_count + t].v);
+      trace_mark(worker_id, 3);
+      trace_commit(worker_id, its);
+
+      if (sparse && diff <= solve_params->epsilon && its > last_check + 1)
+      {
+         /* Converged somewhere after the last check: restore its grid and replay with a check
+            every iteration (every worker takes this branch, they all see the same diff) */
+         copy_block(snap, src, begin_r, end_r, begin_c, end_c);
+         barrier_wait(&bar, &sense);
+         its = last_check;
+         sparse = 0;
+         continue;
+      }
+
+      /* Swap matrix u, w by exchanging the pointers */
+      temp = src;
+      src = dst;
+      dst = temp;
+
+      /* Terminate if temperatures have converged */
+      if (diff <= solve_params->epsilon)
+         break;
+
+      if (checkpoint_every && its % checkpoint_every == 0)
+         write_checkpoint(worker_id, src, its, diff, &sense);
+
+      if (sparse)
+      {
+         copy_block(src, snap, begin_r, end_r, begin_c, end_c);
+         if (check_interval == 0)
+            interval = next_interval(diff, last_diff, its - last_check, interval);
+         last_diff = diff;
+         last_check = its;
+         next_check = its + interval;
+      }
+   }
+
+   if (worker_id == 0)
+   {
+      barrier_its = its;
+      max_diff = diff;
+      u = src;
+      w = dst;
+   }
+
+   getrusage(RUSAGE_THREAD, &thr_usage);
+   stat[worker_id][0] = thr_usage.ru_utime.tv_sec + thr_usage.ru_utime.tv_usec / 1000000.0;
+   stat[worker_id][1] = thr_usage.ru_stime.tv_sec + thr_usage.ru_stime.tv_usec / 1000000.0;
+   return NULL;
+}
+
+/* Interior columns of tile column c under --active-set */
+void active_cols(int c, int *cb, int *ce)
+{
+   *cb = 1 + c * tile_cols;
+   *ce = MIN(*cb + tile_cols - 1, N - 2);
+}
+
+/* Bands of tiles: every worker's rows cut into bands of up to tile_rows rows, so each tile has one owner */
+void active_setup(void)
+{
+   int b = 0, begin_r, end_r;
+
+   act_cols = (N - 2 + tile_cols - 1) / tile_cols;
+   act_bands = 0;
+   for (int i = 0; i < thr_count; i++)
+   {
+      worker_rows(i, &begin_r, &end_r);
+      act_bands += (end_r - begin_r + tile_rows) / tile_rows;
+   }
+   band_r0 = malloc((act_bands + 1) * sizeof(int));
+   band_first = malloc((thr_count + 1) * sizeof(int));
+   for (int i = 0; i < thr_count; i++)
+   {
+      worker_rows(i, &begin_r, &end_r);
+      band_first[i] = b;
+      for (int r = begin_r; r <= end_r; r += tile_rows)
+         band_r0[b++] = r;
+   }
+   band_r0[b] = M - 1;
+   band_first[thr_count] = b;
+   tile_diff = aligned_alloc(CACHE_LINE, (2 * act_bands * act_cols * sizeof(double) + CACHE_LINE - 1) /
+                                             CACHE_LINE * CACHE_LINE);
+   for (int k = 0; k < 2 * act_bands * act_cols; k++)
+      tile_diff[k] = 0.0;
+   atomic_store(&act_swept, 0);
+   atomic_store(&act_skipped, 0);
+}
+
+void active_free(void)
+{
+   free(band_r0);
+   free(band_first);
+   free(tile_diff);
+}
+
+/* Entry function of the worker threads under --active-set: every worker sweeps the unfrozen tiles of
+   its bands, and after the barrier reads the change of every tile (frozen ones read -1) to get the max
+   diff and to freeze or wake its own tiles. A tile freezes after ACTIVE_CALM calm iterations and copies
+   itself into the other buffer, so both hold the same values while it sleeps; it wakes when a neighbour
+   is no longer calm. A converged sweep with frozen tiles wakes them all, so the diff that ends the run
+   is that of a full Jacobi sweep */
+void *thr_func_active(void *arg)
 {
-   int its;                     /* Iterations to converge */
-   double elapsed;              /* Execution time */
-   struct timeval stime, etime; /* Start and end times */
-   struct rusage usage;
+   int worker_id = *(int *)arg;
+   int b0 = band_first[worker_id], b1 = band_first[worker_id + 1], tiles = act_bands * act_cols;
+   int its, b, c, k, t, cb, ce, sense = 0, frozen_any;
+   int *calm = calloc((b1 - b0) * act_cols, sizeof(int)); /* Calm iterations of my tiles, -1 = frozen */
+   double **src = u, **dst = w, **temp, *cur, near;
+   double diff = 0.0, calm_max = solve_params->epsilon * ACTIVE_RATIO;
+   long swept = 0, skipped = 0;
+   struct rusage thr_usage;
 
-   void allocate_2d_array(int, int, double ***);
-   void initialize_array(double ***);
-   void print_solution(char *, double **);
-   int find_steady_state(void);
+   worker_start(worker_id, &sense);
 
-   /* For convenience of other problem size testing */
-   if ((argc == 1) || (argc == 4))
+   for (its = restart_its + 1; its <= max_its; its++)
    {
-      if (argc == 4)
+      trace_mark(worker_id, 0);
+      cur = tile_diff + (its & 1) * tiles;
+      for (b = b0; b < b1; b++)
+         for (c = 0; c < act_cols; c++)
+         {
+            k = b * act_cols + c;
+            if (calm[k - b0 * act_cols] < 0)
+            {
+               cur[k] = -1.0;
+               skipped++;
+               continue;
+            }
+            active_cols(c, &cb, &ce);
+            cur[k] = sweep_block(src, dst, band_r0[b], band_r0[b + 1] - 1, cb, ce);
+            swept++;
+         }
+      trace_mark(worker_id, 1);
+
+      barrier_wait(&bar, &sense);
+      trace_mark(worker_id, 2);
+
+      diff = 0.0;
+      frozen_any = 0;
+      for (k = 0; k < tiles; k++)
       {
-         M = atoi(argv[1]);
-         N = atoi(argv[2]);
-         thr_count = atoi(argv[3]);
-      } // Otherwise use default grid and thread size
+         diff = MAX(diff, cur[k]);
+         frozen_any |= cur[k] < 0.0;
+      }
+      trace_mark(worker_id, 3);
+      trace_commit(worker_id, its);
+
+      /* Swap matrix u, w by exchanging the pointers */
+      temp = src;
+      src = dst;
+      dst = temp;
+
+      /* Terminate if temperatures have converged over the whole grid */
+      if (diff <= solve_params->epsilon && !frozen_any)
+         break;
+
+      for (b = b0; b < b1; b++)
+         for (c = 0; c < act_cols; c++)
+         {
+            k = b * act_cols + c;
+            t = k - b0 * act_cols;
+            near = MAX(b > 0 ? cur[k - act_cols] : 0.0, b < act_bands - 1 ? cur[k + act_cols] : 0.0);
+            near = MAX(near, MAX(c > 0 ? cur[k - 1] : 0.0, c < act_cols - 1 ? cur[k + 1] : 0.0));
+            if (diff <= solve_params->epsilon)
+               calm[t] = 0; /* Converged on the active set: verify on the whole grid */
+            else if (calm[t] < 0)
+               calm[t] = near < calm_max ? -1 : 0;
+            else if (cur[k] < calm_max && near < calm_max)
+            {
+               if (++calm[t] == ACTIVE_CALM)
+               {
+                  active_cols(c, &cb, &ce);
+                  copy_block(src, dst, band_r0[b], band_r0[b + 1] - 1, cb, ce);
+                  calm[t] = -1;
+               }
+            }
+            else
+               calm[t] = 0;
+         }
+
+      if (checkpoint_every && its % checkpoint_every == 0)
+         write_checkpoint(worker_id, src, its, diff, &sense);
    }
-   else
+
+   if (worker_id == 0)
    {
-      printf("Usage: %s [ <rows> <cols> <threads ]>\n", argv[0]);
-      exit(-1);
+      barrier_its = its;
+      max_diff = diff;
+      u = src;
+      w = dst;
    }
+   atomic_fetch_add(&act_swept, swept);
+   atomic_fetch_add(&act_skipped, skipped);
+   free(calm);
 
-   printf("Problem size: M=%d, N=%d\nThread count: T=%d\n", M, N, thr_count);
+   getrusage(RUSAGE_THREAD, &thr_usage);
+   stat[worker_id][0] = thr_usage.ru_utime.tv_sec + thr_usage.ru_utime.tv_usec / 1000000.0;
+   stat[worker_id][1] = thr_usage.ru_stime.tv_sec + thr_usage.ru_stime.tv_usec / 1000000.0;
+   return NULL;
+}
 
-   /* Create the output file */
-   filename = argv[0];
-   sprintf(filename, "%s.dat", filename);
+/* Entry function of the worker threads under --precision float|mixed: Jacobi on the float grids fu and fw
+   by row strips, every worker initializing its own rows; at the end the workers widen their rows into u
+   (final) and w (previous iterate) for the output */
+void *thr_func_float(void *arg)
+{
+   int worker_id = *(int *)arg;
+   int begin_r, end_r, r0, r1, c0, c1, its, r, c, t, sense = 0;
+   float **src = fu, **dst = fw, **temp;
+   double diff = 0.0, d;
+   struct rusage thr_usage;
 
-   allocate_2d_array(M, N, &u);
-   allocate_2d_array(M, N, &w);
-   initialize_array(&u);
-   initialize_array(&w);
+   pin_worker(worker_id);
+   worker_rows(worker_id, &begin_r, &end_r);
+   worker_extent(worker_id, &r0, &r1, &c0, &c1);
+   for (r = r0; r <= r1; r++)
+      for (c = 0; c < N; c++)
+         src[r][c] = dst[r][c] = (float)initial_value(solve_params, r, c);
+   barrier_wait(&bar, &sense);
 
-   gettimeofday(&stime, NULL);
-   its = find_steady_state();
-   gettimeofday(&etime, NULL);
+   for (its = 1; its <= max_its; its++)
+   {
+      trace_mark(worker_id, 0);
+      diff = 0.0;
+      for (r = begin_r; r <= end_r; r++)
+      {
+         d = row_float(src[r - 1], src[r], src[r + 1], dst[r], N);
+         diff = MAX(diff, d);
+      }
+      diff_slot[(its & 1) * thr_count + worker_id].v = diff;
+      trace_mark(worker_id, 1);
 
-   elapsed = ((etime.tv_sec * 1000000 + etime.tv_usec) - (stime.tv_sec * 1000000 + stime.tv_usec)) / 1000000.0;
+      barrier_wait(&bar, &sense);
+      trace_mark(worker_id, 2);
 
-   printf("Converged after %d iterations with error: %8.6f.\n", its, final_diff);
-   printf("Elapsed time = %8.4f sec.\n", elapsed);
+      diff = 0.0;
+      for (t = 0; t < thr_count; t++)
+         diff = MAX(diff, diff_slot[(its & 1) * thr_count + t].v);
+      trace_mark(worker_id, 3);
+      trace_commit(worker_id, its);
 
-   getrusage(RUSAGE_SELF, &usage);
-   printf("Program completed - user: %.4f s, system: %.4f s\n",
-          (usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0),
-          (usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0));
-   printf("no. of context switches: vol %ld, invol %ld\n\n",
-          usage.ru_nvcsw, usage.ru_nivcsw);
+      /* Swap matrix u, w by exchanging the pointers */
+      temp = src;
+      src = dst;
+      dst = temp;
+
+      /* Terminate if temperatures have converged */
+      if (diff <= solve_params->epsilon)
+         break;
+   }
+
+   for (r = r0; r <= r1; r++)
+      for (c = 0; c < N; c++)
+      {
+         u[r][c] = src[r][c];
+         w[r][c] = dst[r][c];
+      }
+   if (worker_id == 0)
+   {
+      barrier_its = its;
+      max_diff = diff;
+   }
 
-   print_solution(filename, w);
+   getrusage(RUSAGE_THREAD, &thr_usage);
+   stat[worker_id][0] = thr_usage.ru_utime.tv_sec + thr_usage.ru_utime.tv_usec / 1000000.0;
+   stat[worker_id][1] = thr_usage.ru_stime.tv_sec + thr_usage.ru_stime.tv_usec / 1000000.0;
+   return NULL;
 }
 
-/* Allocate two-dimensional array. */
-void allocate_2d_array(int r, int c, double ***a)
+/* Update columns first..last of row r from the state (from, fr0, fc0) into the state (to, tr0, tc0),
+   a state being a set of row pointers whose first row and column are grid row fr0 and column fc0 */
+double block_row(double **from, int fr0, int fc0, double **to, int tr0, int tc0, int r, int first, int last)
 {
-   double *storage;
-   int i;
-   storage = (double *)malloc(r * c * sizeof(double));
-   *a = (double **)malloc(r * sizeof(double *));
-   for (i = 0; i < r; i++)
-      (*a)[i] = &storage[i * c];
+   if (last < first)
+      return 0.0;
+   return row_kernel(from[r - 1 - fr0] + first - 1 - fc0, from[r - fr0] + first - 1 - fc0,
+                     from[r + 1 - fr0] + first - 1 - fc0, to[r - tr0] + first - 1 - tc0, last - first + 3);
 }
 
-/* Set initial and boundary conditions */
-void initialize_array(double ***u)
+/* Advance the tile rows rb..re, columns cb..ce by steps iterations from src into dst without touching
+   the rest of dst: step 1 reads src, the intermediate steps live in the private buffers a and b
+   (the tile plus a ghost zone of steps cells on every side), the last step writes dst. Each step
+   shrinks the valid region by one cell on every side, so the ghost cells are computed redundantly by
+   the neighbouring tiles and the tile itself ends exact. step_diff[s] gets the max change of the
+   tile's own cells at step s+1 */
+void advance_block(double **src, double **dst, double **a, double **b, int rb, int re, int cb, int ce,
+                   int steps, double *step_diff)
 {
-   int i, j;
+   int lo = MAX(0, rb - steps), hi = MIN(M - 1, re + steps);
+   int clo = MAX(0, cb - steps), chi = MIN(N - 1, ce + steps);
+   double **from = src, **to;
+   int fr0 = 0, fc0 = 0, tr0, tc0, r;
+   double d;
 
-   /* Set initial values and boundary conditions */
-   for (i = 0; i < M; i++)
+   /* The fixed boundary cells the buffers will read are never computed, copy them in */
+   for (r = lo; r <= hi; r++)
    {
-      for (j = 0; j < N; j++)
-         (*u)[i][j] = 25.0; /* Room temperature */
-      (*u)[i][0] = 0.0;
-      (*u)[i][N - 1] = 0.0;
+      if (r == 0 || r == M - 1)
+      {
+         memcpy(a[r - lo], src[r] + clo, (chi - clo + 1) * sizeof(double));
+         memcpy(b[r - lo], src[r] + clo, (chi - clo + 1) * sizeof(double));
+         continue;
+      }
+      if (clo == 0)
+         a[r - lo][0] = b[r - lo][0] = src[r][0];
+      if (chi == N - 1)
+         a[r - lo][chi - clo] = b[r - lo][chi - clo] = src[r][N - 1];
    }
 
-   for (j = 0; j < N; j++)
+   for (int s = 1; s <= steps; s++)
    {
-      (*u)[0][j] = 0.0;
-      (*u)[M - 1][j] = 1000.0; /* Heat source */
+      int first = MAX(1, rb - steps + s), last = MIN(M - 2, re + steps - s);
+      int cfirst = MAX(1, cb - steps + s), clast = MIN(N - 2, ce + steps - s);
+
+      if (s == steps)
+      {
+         to = dst;
+         tr0 = tc0 = 0;
+      }
+      else
+      {
+         to = (s & 1) ? a : b;
+         tr0 = lo;
+         tc0 = clo;
+      }
+      for (r = first; r <= last; r++)
+      {
+         if (r < rb || r > re)
+         {
+            block_row(from, fr0, fc0, to, tr0, tc0, r, cfirst, clast);
+            continue;
+         }
+         block_row(from, fr0, fc0, to, tr0, tc0, r, cfirst, cb - 1);
+         block_row(from, fr0, fc0, to, tr0, tc0, r, ce + 1, clast);
+         d = block_row(from, fr0, fc0, to, tr0, tc0, r, cb, ce);
+         if (d > step_diff[s - 1])
+            step_diff[s - 1] = d;
+      }
+      from = to;
+      fr0 = tr0;
+      fc0 = tc0;
    }
 }
 
-/* Print solution to standard output or a file */
-void print_solution(char *filename, double **u)
+/* Advance rows begin_r..end_r of the grid by steps iterations, tile by tile */
+void advance_rows(double **src, double **dst, double **a, double **b, int begin_r, int end_r, int steps,
+                  double *step_diff)
 {
-   int i, j;
-   char sep;
-   FILE *outfile;
+   for (int rb = begin_r; rb <= end_r; rb += tile_rows)
+      for (int cb = 1; cb <= N - 2; cb += tile_cols)
+         advance_block(src, dst, a, b, rb, MIN(rb + tile_rows - 1, end_r), cb, MIN(cb + tile_cols - 1, N - 2),
+                       steps, step_diff);
+}
 
-   if (!filename)
-   {              /* if no filename specified, print on screen */
-      sep = '\t'; /* tab added for easier view */
-      outfile = stdout;
-   }
-   else
+/* Entry function of the worker threads with temporal tiling: one barrier per pass of up to tile_steps
+   iterations; after it every worker finds the first converged step from all the per-step slots and,
+   if that is inside the pass, redoes the pass (u still holds its start) up to that step only */
+void *thr_func_tiled(void *arg)
+{
+   void allocate_2d_array(int, int, double ***);
+   int worker_id = *(int *)arg;
+   int begin_r, end_r, its = 0, steps, hit = 0, pass, t, s, sense = 0;
+   double **src = u, **dst = w, **temp, **a, **b;
+   double diff = 0.0, step_max, *mine;
+   struct rusage thr_usage;
+
+   worker_start(worker_id, &sense);
+   worker_rows(worker_id, &begin_r, &end_r);
+   allocate_2d_array(tile_rows + 2 * tile_steps, tile_cols + 2 * tile_steps, &a);
+   allocate_2d_array(tile_rows + 2 * tile_steps, tile_cols + 2 * tile_steps, &b);
+
+   for (pass = 0; its < max_its; pass++)
    {
-      sep = '\n'; /* for gnuplot format */
-      outfile = fopen(filename, "w");
-      if (outfile == NULL)
+      steps = max_its - its < tile_steps ? (int)(max_its - its) : tile_steps;
+      mine = step_slot + ((pass & 1) * thr_count + worker_id) * step_stride;
+      for (s = 0; s < steps; s++)
+         mine[s] = 0.0;
+      advance_rows(src, dst, a, b, begin_r, end_r, steps, mine);
+
+      barrier_wait(&bar, &sense);
+
+      hit = 0;
+      for (s = 0; s < steps && !hit; s++)
       {
-         printf("Can't open output file.");
-         exit(-1);
+         step_max = 0.0;
+         for (t = 0; t < thr_count; t++)
+            step_max = MAX(step_max, step_slot[((pass & 1) * thr_count + t) * step_stride + s]);
+         diff = step_max;
+         hit = diff <= solve_params->epsilon ? s + 1 : 0;
       }
+
+      if (hit > 1)
+      {
+         /* Converged inside the pass: src is untouched, so bring dst to the step before convergence
+            and do the last step as a plain sweep back into src, leaving u = final and w = previous
+            iterate exactly as the untiled loop does */
+         double scratch[tile_steps];
+
+         memset(scratch, 0, sizeof(scratch));
+         advance_rows(src, dst, a, b, begin_r, end_r, hit - 1, scratch);
+         barrier_wait(&bar, &sense);
+         sweep_rows(dst, src, begin_r, end_r);
+         temp = src; /* so that the swap below leaves src = final, dst = previous */
+         src = dst;
+         dst = temp;
+      }
+      else if (hit == 1 && steps > 1)
+         /* Converged on the first step of the pass: dst is already steps iterations ahead, so redo
+            that one step from the untouched src; the swap below leaves src = final, dst = previous */
+         sweep_rows(src, dst, begin_r, end_r);
+      its += hit ? hit : steps;
+
+      /* Swap matrix u, w by exchanging the pointers */
+      temp = src;
+      src = dst;
+      dst = temp;
+
+      /* Terminate if temperatures have converged */
+      if (hit)
+         break;
    }
+   if (!hit)
+      its = max_its + 1; /* Same count as the untiled loop when the limit is reached */
 
-   /* Print the solution array */
-   for (i = 0; i < M; i++)
+   if (worker_id == 0)
    {
-      for (j = 0; j < N; j++)
-         fprintf(outfile, "%6.2f%c", u[i][j], sep);
-      fprintf(outfile, "\n"); /* Empty line for gnuplot */
+      barrier_its = its;
+      max_diff = diff;
+      u = src;
+      w = dst;
    }
-   if (outfile != stdout)
-      fclose(outfile);
+   free(a[0]);
+   free(a);
+   free(b[0]);
+   free(b);
+
+   getrusage(RUSAGE_THREAD, &thr_usage);
+   stat[worker_id][0] = thr_usage.ru_utime.tv_sec + thr_usage.ru_utime.tv_usec / 1000000.0;
+   stat[worker_id][1] = thr_usage.ru_stime.tv_sec + thr_usage.ru_stime.tv_usec / 1000000.0;
+   return NULL;
 }
 
 /* Entry function of the worker threads */
@@ -176,38 +2610,21 @@ void *thr_func(void *arg)
 
    int worker_id = *(int *)arg;
    
-   int begin_r = (int)(worker_id * M / thr_count);
-   int end_r = (int)((worker_id + 1) * M / thr_count - 1);
+   int begin_r, end_r;
    double diff; /* Maximum temperature difference within threads */
    struct rusage thr_usage;
 
    // update begin_r and end_r according to wotker_id
-   if (worker_id == 0)
-   {
-      begin_r++;
-   }
-   if (worker_id == (thr_count - 1))
-   {
-      end_r--;
-   }
+   pin_worker(worker_id);
+   worker_rows(worker_id, &begin_r, &end_r);
 
    sem_wait(&start);
 
    while (StopOrCtn)
    {
-      diff = 0.0;
       //update the data of w[][] and diff
-      
-      for (int r = begin_r; r <= end_r; r++)
-      {
-         for (int c = 1; c < N - 1; c++)
-         {
-            w[r][c] = 0.25 * (u[r - 1][c] + u[r + 1][c] + u[r][c - 1] + u[r][c + 1]);
-            if (fabs(w[r][c] - u[r][c]) > diff)
-               diff = fabs(w[r][c] - u[r][c]);
-         }
-      }
-      
+      diff = sweep_rows(u, w, begin_r, end_r);
+
       sem_wait(&mutex);
 
       if (diff > max_diff)
@@ -217,7 +2634,7 @@ void *thr_func(void *arg)
           sem_post(&finish);                                                                                                                                  
 //tell master thread that this worker is finished
      
-      sem_wait(&sig);// waiting for the response from the master thread
+      sem_wait(&sig[worker_id]);// waiting for the response from the master thread
 
    }
    getrusage(RUSAGE_THREAD, &thr_usage);
@@ -228,8 +2645,289 @@ void *thr_func(void *arg)
    pthread_exit ((void * )&thr_usage);
 }
 
+/* Iterations per second of both synchronization schemes over a fixed number of iterations,
+   for 1, 2, 4, ... threads up to thr_count */
+void sync_benchmark(void)
+{
+   void initialize_array(double ***);
+   int find_steady_state(void);
+   int threads = thr_count, saved_mode = sync_mode;
+   long saved_its = max_its;
+   double rate[2];
+   struct timespec t0, t1;
+
+   quiet = 1;
+   max_its = bench_its;
+   printf("%ld iterations per run (fewer if the grid converges first)\n", bench_its);
+   printf("%8s %16s %16s %9s\n", "threads", "sem (its/s)", "barrier (its/s)", "speedup");
+   for (int t = 1; t <= threads; t = (t < threads && t * 2 > threads) ? threads : t * 2)
+   {
+      thr_count = t;
+      for (int mode = SYNC_SEM; mode <= SYNC_BARRIER; mode++)
+      {
+         sync_mode = mode;
+         initialize_array(&u);
+         initialize_array(&w);
+         clock_gettime(CLOCK_MONOTONIC, &t0);
+         int its = find_steady_state();
+         clock_gettime(CLOCK_MONOTONIC, &t1);
+         if (its > max_its)
+            its = max_its;
+         rate[mode] = its / ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+      }
+      printf("%8d %16.0f %16.0f %8.2fx\n", t, rate[SYNC_SEM], rate[SYNC_BARRIER],
+             rate[SYNC_BARRIER] / rate[SYNC_SEM]);
+      if (t == threads)
+         break;
+   }
+   thr_count = threads;
+   sync_mode = saved_mode;
+   max_its = saved_its;
+   quiet = 0;
+}
+
+/* Run the chosen configuration on a rows x cols grid with threads workers, solving again until
+   BENCH_MIN_TIME has passed; returns the seconds spent and the iterations done in *its_done */
+double bench_run(int rows, int cols, int threads, long *its_done)
+{
+   void allocate_2d_array(int, int, double ***);
+   void initialize_array(double ***);
+   int find_steady_state(void);
+   double elapsed = 0.0;
+   struct timespec t0, t1;
+
+   M = grid_params.rows = rows;
+   N = grid_params.cols = cols;
+   thr_count = threads;
+   if (decomp_blocks)
+      choose_blocks();
+   if (solver == SOLVER_SOR && grid_params.omega == 0.0)
+      omega = optimal_omega(M, N);
+   max_its = MAX(BENCH_MIN_ITS, (long)(BENCH_UPDATES / ((double)(M - 2) * (N - 2))));
+   allocate_2d_array(M, N, &u);
+   allocate_2d_array(M, N, &w);
+   *its_done = 0;
+   while (elapsed < BENCH_MIN_TIME)
+   {
+      if (!first_touch && precision == PREC_DOUBLE)
+      {
+         initialize_array(&u);
+         initialize_array(&w);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      int its = find_steady_state();
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      *its_done += MIN(its, max_its);
+      elapsed += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+   }
+   free(u[0]);
+   free(w[0]);
+   free(u);
+   free(w);
+   return elapsed;
+}
+
+/* --bench-suite: strong scaling on grids whose two buffers fill about half of L1, of L2, of the LLC,
+   and BENCH_DRAM times the LLC, then weak scaling with an L2-sized strip per thread; one CSV line or
+   JSON object per run. GFLOP/s counts the stencil flops (4 per cell for Jacobi, 7 with the SOR
+   relaxation), the bandwidth one read and one write of every cell per iteration */
+void bench_suite_run(void)
+{
+   const char *classes[] = {"L1", "L2", "LLC", "DRAM", "L2/thread"};
+   long bytes[] = {cache_size(_SC_LEVEL1_DCACHE_SIZE, 32 * 1024) / 2, cache_size(_SC_LEVEL2_CACHE_SIZE, 1024 * 1024) / 2,
+                   cache_size(_SC_LEVEL3_CACHE_SIZE, 32 * 1024 * 1024) / 2, 0, 0};
+   int threads = thr_count, rows = M, cols = N, elem = precision == PREC_DOUBLE ? sizeof(double) : sizeof(float);
+   int flops = solver == SOLVER_SOR ? 7 : 4, side, t, k, first = 1;
+   long its, saved_its = max_its;
+   double secs, base = 0.0, rate, updates;
+
+   bytes[3] = 2 * BENCH_DRAM * bytes[2];
+   bytes[4] = bytes[1];
+   quiet = 1;
+   if (bench_suite == SUITE_CSV)
+      printf("scaling,grid,rows,cols,threads,iterations,seconds,its_per_sec,mlups,gflops,gbytes_per_sec,speedup,"
+             "efficiency\n");
+   else
+      printf("{\"kernel\": \"%s\", \"sync\": \"%s\", \"solver\": \"%s\", \"precision\": \"%s\", \"tile\": %d, "
+             "\"decomp\": \"%s\", \"max_threads\": %d, \"runs\": [\n",
+             kernel_name, sync_mode == SYNC_SEM ? "sem" : "barrier",
+             solver == SOLVER_SOR ? "sor" : solver == SOLVER_MG ? "mg" : "jacobi",
+             precision == PREC_FLOAT ? "float" : precision == PREC_MIXED ? "mixed" : "double", tile_steps,
+             decomp_blocks ? "blocks" : "rows", threads);
+   for (k = 0; k < 5; k++)
+   {
+      side = MAX(3, (int)sqrt(bytes[k] / (2.0 * elem)));
+      for (t = 1; t <= threads; t = (t < threads && t * 2 > threads) ? threads : t * 2)
+      {
+         int m = k == 4 ? t * (side - 2) + 2 : side;
+
+         if (t > m - 2)
+            break;
+         secs = bench_run(m, side, t, &its);
+         rate = its / secs;
+         updates = rate * (m - 2) * (side - 2);
+         if (t == 1)
+            base = k == 4 ? rate * (m - 2) : rate; /* Weak scaling compares cell updates/sec per row */
+         double speedup = k == 4 ? updates / (side - 2) / base : rate / base;
+
+         if (bench_suite == SUITE_CSV)
+            printf("%s,%s,%d,%d,%d,%ld,%.4f,%.1f,%.1f,%.3f,%.3f,%.3f,%.3f\n", k == 4 ? "weak" : "strong",
+                   classes[k], m, side, t, its, secs, rate, updates / 1e6, flops * updates / 1e9,
+                   2.0 * elem * updates / 1e9, speedup, speedup / t);
+         else
+         {
+            printf("%s  {\"scaling\": \"%s\", \"grid\": \"%s\", \"rows\": %d, \"cols\": %d, \"threads\": %d, "
+                   "\"iterations\": %ld, \"seconds\": %.4f, \"its_per_sec\": %.1f, \"mlups\": %.1f, "
+                   "\"gflops\": %.3f, \"gbytes_per_sec\": %.3f, \"speedup\": %.3f, \"efficiency\": %.3f}",
+                   first ? "" : ",\n", k == 4 ? "weak" : "strong", classes[k], m, side, t, its, secs, rate,
+                   updates / 1e6, flops * updates / 1e9, 2.0 * elem * updates / 1e9, speedup, speedup / t);
+            first = 0;
+         }
+         fflush(stdout);
+         if (t == threads)
+            break;
+      }
+   }
+   if (bench_suite == SUITE_JSON)
+      printf("\n]}\n");
+   M = grid_params.rows = rows;
+   N = grid_params.cols = cols;
+   thr_count = threads;
+   max_its = saved_its;
+   quiet = 0;
+}
+
+void trace_setup(void)
+{
+   traces = aligned_alloc(CACHE_LINE, thr_count * sizeof(trace_thread));
+   memset(traces, 0, thr_count * sizeof(trace_thread));
+   for (int i = 0; i < thr_count; i++)
+      traces[i].ring = calloc(TRACE_RING, sizeof(trace_rec));
+   clock_gettime(CLOCK_MONOTONIC, &trace_mono0);
+   trace_tick0 = trace_now();
+}
+
+/* Print a histogram line per bucket, the bar scaled to the fullest bucket */
+void trace_histogram(const char *title, const char **labels, const long *counts, int buckets)
+{
+   long most = 1, total = 0;
+
+   for (int b = 0; b < buckets; b++)
+   {
+      most = MAX(most, counts[b]);
+      total += counts[b];
+   }
+   printf("%s\n", title);
+   for (int b = 0; b < buckets; b++)
+   {
+      char bar[41];
+      int len = (int)(40 * counts[b] / most);
+
+      memset(bar, '#', len);
+      bar[len] = '\0';
+      printf("  %8s |%-40s %8ld (%5.1f%%)\n", labels[b], bar, counts[b], total ? 100.0 * counts[b] / total : 0.0);
+   }
+}
+
+/* After the workers: time split per thread, histograms of the sweep imbalance of every kept iteration
+   (max / mean - 1 of the threads' sweep times) and of the barrier wait share of every thread-iteration,
+   and the Chrome trace if asked for */
+void trace_report(void)
+{
+   static const char *imb_labels[] = {"<2%", "2-5%", "5-10%", "10-20%", "20-50%", "50-100%", ">=100%"};
+   static const double imb_edges[] = {0.02, 0.05, 0.10, 0.20, 0.50, 1.00};
+   static const char *wait_labels[] = {"<10%", "10-25%", "25-50%", "50-75%", ">=75%"};
+   static const double wait_edges[] = {0.10, 0.25, 0.50, 0.75};
+   long imb[7] = {0}, waits[5] = {0};
+   struct timespec mono1;
+   uint64_t tick1 = trace_now();
+   double per_us, total, worst;
+   int i, s, b, kept = 0;
+
+   clock_gettime(CLOCK_MONOTONIC, &mono1);
+   per_us = (tick1 - trace_tick0) /
+            MAX(1.0, (mono1.tv_sec - trace_mono0.tv_sec) * 1e6 + (mono1.tv_nsec - trace_mono0.tv_nsec) / 1e3);
+
+   printf("Instrumentation: %ld iterations per thread, the last %d kept\n", traces[0].iterations,
+          (int)MIN(traces[0].iterations, TRACE_RING));
+   printf("%8s %12s %12s %12s %8s\n", "thread", "sweep (ms)", "wait (ms)", "reduce (ms)", "wait %");
+   for (i = 0; i < thr_count; i++)
+   {
+      total = traces[i].sum[0] + traces[i].sum[1] + traces[i].sum[2];
+      printf("%8d %12.2f %12.2f %12.2f %7.1f%%\n", i, traces[i].sum[0] / per_us / 1e3, traces[i].sum[1] / per_us / 1e3,
+             traces[i].sum[2] / per_us / 1e3, total > 0 ? 100.0 * traces[i].sum[1] / total : 0.0);
+   }
+
+   for (s = 0; s < TRACE_RING; s++)
+   {
+      trace_rec *r0 = &traces[0].ring[s];
+      double sum = 0.0, sweep;
+
+      if (r0->its == 0)
+         continue;
+      worst = 0.0;
+      for (i = 0; i < thr_count && traces[i].ring[s].its == r0->its; i++)
+      {
+         trace_rec *r = &traces[i].ring[s];
+
+         sweep = (double)(r->t[1] - r->t[0]);
+         sum += sweep;
+         worst = MAX(worst, sweep);
+         total = (double)(r->t[3] - r->t[0]);
+         for (b = 0; b < 4 && total > 0 && (r->t[2] - r->t[1]) / total >= wait_edges[b]; b++)
+            ;
+         waits[b]++;
+      }
+      if (i < thr_count || sum <= 0.0)
+         continue; /* Not every thread kept this iteration */
+      kept++;
+      for (b = 0; b < 6 && worst / (sum / thr_count) - 1.0 >= imb_edges[b]; b++)
+         ;
+      imb[b]++;
+   }
+   trace_histogram("Sweep imbalance per iteration (slowest / mean sweep - 1):", imb_labels, imb, 7);
+   trace_histogram("Barrier wait share per thread-iteration:", wait_labels, waits, 5);
+
+   if (trace_path)
+   {
+      FILE *out = fopen(trace_path, "w");
+      static const char *phases[] = {"sweep", "wait", "reduce"};
+      int first = 1;
+
+      if (!out)
+         printf("Can't open %s\n", trace_path);
+      else
+      {
+         fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+         for (i = 0; i < thr_count; i++)
+            for (s = 0; s < TRACE_RING; s++)
+            {
+               trace_rec *r = &traces[i].ring[s];
+
+               if (r->its == 0)
+                  continue;
+               for (b = 0; b < 3; b++)
+               {
+                  fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, "
+                          "\"dur\": %.3f, \"args\": {\"iteration\": %d}}", first ? "" : ",\n", phases[b], i,
+                          (r->t[b] - trace_tick0) / per_us, (r->t[b + 1] - r->t[b]) / per_us, r->its);
+                  first = 0;
+               }
+            }
+         fprintf(out, "\n]}\n");
+         fclose(out);
+         printf("Trace of %d iterations written to %s\n", kept, trace_path);
+      }
+   }
+
+   for (i = 0; i < thr_count; i++)
+      free(traces[i].ring);
+   free(traces);
+}
+
 int find_steady_state(void)
 {
+   void allocate_2d_float(int, int, float ***);
 
    int its; /* Iteration count */
    int i, j;
@@ -242,11 +2940,95 @@ int find_steady_state(void)
    pthread_t* threads = (pthread_t*)malloc(thr_count * sizeof(pthread_t));
    int* thread_ids = (int*)malloc(thr_count * sizeof(int));
 
+   if (sync_mode == SYNC_BARRIER)
+   {
+      barrier_init(&bar, thr_count);
+      diff_slot = aligned_alloc(CACHE_LINE, 2 * thr_count * sizeof(padded_double));
+      step_stride = (tile_steps + CACHE_LINE / sizeof(double) - 1) / (CACHE_LINE / sizeof(double)) *
+                    (CACHE_LINE / sizeof(double));
+      step_slot = aligned_alloc(CACHE_LINE, 2 * thr_count * step_stride * sizeof(double));
+      if (check_interval != 1)
+         allocate_2d_array(M, N, &snap);
+      if (solver != SOLVER_JACOBI)
+         mg_setup();
+      if (active_set)
+         active_setup();
+      if (instrument)
+         trace_setup();
+      if (precision != PREC_DOUBLE)
+      {
+         allocate_2d_float(M, N, &fu);
+         allocate_2d_float(M, N, &fw);
+      }
+      for (i = 0; i < thr_count; i++)
+      {
+         void *(*entry)(void *) = tile_steps > 1 ? thr_func_tiled : thr_func_barrier;
+
+         if (solver == SOLVER_SOR)
+            entry = thr_func_sor;
+         else if (solver == SOLVER_MG)
+            entry = thr_func_mg;
+         else if (active_set)
+            entry = thr_func_active;
+         else if (precision != PREC_DOUBLE)
+            entry = thr_func_float;
+         thread_ids[i] = i;
+         pthread_create(&threads[i], NULL, entry, (void *)&thread_ids[i]);
+      }
+      for (i = 0; i < thr_count; i++)
+      {
+         pthread_join(threads[i], NULL);
+         if (!quiet)
+            printf("Thread %d has completed - user: %.4f s, system: %.4f s\n", i,
+                   stat[i][0], stat[i][1]);
+      }
+      its = barrier_its;
+      free(diff_slot);
+      free(step_slot);
+      if (check_interval != 1)
+      {
+         free(snap[0]);
+         free(snap);
+      }
+      if (solver != SOLVER_JACOBI)
+         mg_free();
+      if (active_set && !quiet)
+      {
+         long swept = atomic_load(&act_swept), skipped = atomic_load(&act_skipped);
+
+         printf("Active set: %.1f%% of %ld tile sweeps skipped\n",
+                swept + skipped ? 100.0 * skipped / (swept + skipped) : 0.0, swept + skipped);
+      }
+      if (active_set)
+         active_free();
+      if (instrument)
+      {
+         if (!quiet)
+            trace_report();
+         else
+         {
+            for (i = 0; i < thr_count; i++)
+               free(traces[i].ring);
+            free(traces);
+         }
+      }
+      if (precision != PREC_DOUBLE)
+      {
+         free(fu[0]);
+         free(fu);
+         free(fw[0]);
+         free(fw);
+      }
+      goto done;
+   }
+
    sem_init(&mutex, 0, 1);
 
    sem_init(&finish, 0, 0);
 
-   sem_init(&sig, 0, 0);
+   sig = malloc(thr_count * sizeof(sem_t));
+   for (i = 0; i < thr_count; i++)
+      sem_init(&sig[i], 0, 0);
 
    sem_init(&start, 0, 0);
   
@@ -258,10 +3040,9 @@ int find_steady_state(void)
    }
 
    //iteration limit
+   max_diff = 0.0;
    for (its = 1; its <= max_its; its++)
    {
-      max_diff = 0.0;
-
       StopOrCtn =1;
 
       if(its==1){
@@ -282,13 +3063,14 @@ int find_steady_state(void)
       w = temp;
 
       /* Terminate if temperatures have converged */
-      if (max_diff <= EPSILON)
+      if (max_diff <= solve_params->epsilon)
          break;
       else
       {
+         max_diff = 0.0; // reset before the workers are released, not after
          for (i = 0; i < thr_count; i++)
          {
-            sem_post(&sig);
+            sem_post(&sig[i]);
          }
       }
    }
@@ -300,7 +3082,7 @@ int find_steady_state(void)
    for (i = 0; i < thr_count; i++)
    {
       
-      sem_post(&sig);
+      sem_post(&sig[i]);
 
    }
 
@@ -311,8 +3093,21 @@ int find_steady_state(void)
 
       pthread_join(threads[i], (void *)&thr_usage); // retrive info from thread usage
 
-      printf("Thread %d has completed - user: %.4f s, system: %.4f s\n", i,
-             stat[i][0],stat[i][1]);
+      if (!quiet)
+         printf("Thread %d has completed - user: %.4f s, system: %.4f s\n", i,
+                stat[i][0],stat[i][1]);
+   }
+   free(sig);
+
+done:
+   free(threads);
+   free(thread_ids);
+   free(stat[0]);
+   free(stat);
+   if (quiet)
+   {
+      final_diff = max_diff;
+      return its;
    }
 
    getrusage(RUSAGE_SELF, &func_usage);
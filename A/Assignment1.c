@@ -1,393 +1,2025 @@
-//Filename: monitor.c
-
-//Development platform: WSL
-//Remark: Everything except the running statistics for the last command with pipes since it's a parent process 
-//        e.g. the running statistics of "wc -c"  in " cat m.c ! grep io ! wc -c "
-// Basically, I handle this assignment with 3 cases 
-// 1. without pipe: execvp
-// 2. with 1 pipe: communication between parent and child 
-// 3. with more than 1 pipe: communication using a shared tempory file among children and the last command as a independent process 
-
-
-#include <unistd.h>
-#include <sys/wait.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <ctype.h>
-#include <string.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <signal.h>
-#include <sys/types.h>
-#include <sys/time.h>
-#include <sys/resource.h>
-
-
-int argnum;                                     // number of the input argument
-// char* argv[1000];                            // input argument array
-char* command[1000];                            // the whole command
-int i, j;                                       // variable for looping
-
-
-char* sigcodeConv(int sig) {// convert signal codes to standardized signal names
-    switch(sig){
-        case 1 : return "SIGHUP";
-        case 2 : return "SIGINT";
-        case 3 : return "SIGQUIT";
-        case 4 : return "SIGILL";
-        case 5 : return "SIGTRAP";
-        case 6 : return "SIGABRT or SIGIOT";
-        case 7 : return "SIGBUS";
-        case 8 : return "SIGFPE";
-        case 9 : return "SIGKILL";
-        case 10 : return "SIGUSR1";
-        case 11 : return "SIGSEGV";
-        case 12 : return "SIGUSR2";
-        case 13 : return "SIGPIPE";
-        case 14 : return "SIGALRM";
-        case 15 : return "SIGTERM";
-        case 16 : return "SIGSTKFLT";
-        case 17 : return "SIGCHLD";
-        case 18 : return "SIGCONT";
-        case 19 : return "SIGSTOP";
-        case 20 : return "SIGTSTP";
-        case 21 : return "SIGTTIN";
-        case 22 : return "SIGTTOU";
-        case 23 : return "SIGURG";
-        case 24 : return "SIGXCPU";
-        case 25 : return "SIGXFSZ";
-        case 26 : return "SIGVTALRM";
-        case 27 : return "SIGPROF";
-        case 28 : return "SIGWINCH  ";
-        case 29 : return "SIGIO or SIGPOLL";
-        case 30 : return "SIGPWR";
-        case 31 : return "SIGSYS or SIGUNUSED";
-
-     return "Unknown signal code";
- }
-}
-
-int commandWithPipe(char *command[argnum]) {
-    
-
-    int pipnum=0; 
-
-    for(j = 0; j<argnum; j++) {
-        if (strcmp(command[j], "!") == 0)
-        { pipnum++;}
-    } // find the number of pipes
-   
-
-    if (pipnum == 1 )  // use the parent-child process to implement the simpliest case with only one pipe
-    { 
-        
-        for(j = 0; j<argnum; j++) {
-        if (strcmp(command[j], "!") == 0)
-            break; } // j stores the position of the logic pipe '!'
-                        
-        char *outputBuf[1000]; 
-        for (i = 0; i < j ; i++) {
-            outputBuf[i] = command[i];
-        } //outputBuf is the command before the logic pipe '!'
-
-        char *inputBuf[1000];
-        for (i = 0; i < argnum-1- j; i++) {
-            inputBuf[i] = command[j + 1 + i];
-        } //inputBuf is the command after the logic pipe '!'
-     
-        int pd[2];
-        pid_t pid;
-        if (pipe(pd) < 0) {
-            perror("pipe()");
-            exit(1);
-        } // create pipe
-
-        struct timeval start, end;
-        int time_used;  
-        gettimeofday(&start, NULL); // real time at the start of the program
-
-        pid = fork();
-
-        if (pid < 0) {
-            perror("fork()");
-            exit(1);
-        }
-
-        //  close the read end of the child process
-        if (pid == 0) {                      
-            
-            printf("Process with id: %d created for the command: %s \n", getpid(),outputBuf[0]);
-            close(pd[0]);                   // STDOUT_FILENO  refers to pd[1]
-            dup2(pd[1], STDOUT_FILENO);     
-            execvp(outputBuf[0], outputBuf);
-            if (pd[1] != STDOUT_FILENO) {
-                close(pd[1]);
-            }
-            exit(1);
-        }
-        // parent process read output from pipe
-        else {                              
-    
-            int status;
-            struct rusage usage;
-            signal(SIGINT, SIG_IGN);
-            wait4(pid, &status, 0, &usage);
-            
-            gettimeofday(&end, NULL);  // real time at the end of the program
-            
-            //error handling of the child process(first command)
-            if (WIFEXITED(status)) {	
-                printf("The command %s terminated with returned status code = %d\n\n", outputBuf[0],WEXITSTATUS(status));
-                if(WEXITSTATUS(status)){ // (WEXITSTATUS(status)==1 means the child process ended with errors 
-                    if (outputBuf[0][0] != '.' && outputBuf[0][0]!='/'){
-                        printf("exec: : Not a basic linux command i.e. not in /usr/bin \n\n");
-                    }
-                    else{
-                        printf("exec: : No such file or directory\n");
-                        printf("Debug hint: incorrect filename, incorrect path etc.\n\n");
-                    }
-                printf("monitor experienced an error in starting the command: %s \n\n", outputBuf[0]);
-                }
-            }  // if WIFEXITED(status)== true, WEXITSTATUS(status) returns the termination status
-            if(WIFSIGNALED(status)){
-                printf("The command %s is interrupted by the signal number = %d (%s)\n\n", outputBuf[0], WTERMSIG(status), strsignal(WTERMSIG(status)));
-            }  //if WIFSIGNALED(status)== true,  WTERMSIG(status) returns the number of the signal that terminated the child process
-            
-
-            //print running statistics of the child process(first command)
-            printf("The running statistics for %s as follows: \n", outputBuf[0]);
-            printf("real: %.03f s, ",(double)(end.tv_sec + end.tv_usec / 1000000 - start.tv_sec - start.tv_usec / 1000000));
-            printf("user: %ld.%03ld s, system: %ld.%03ld s \n",usage.ru_utime.tv_sec, usage.ru_utime.tv_usec/1000, usage.ru_stime.tv_sec, usage.ru_stime.tv_usec/1000);
-            printf("no. of page faults: %ld \n", usage.ru_minflt+usage.ru_majflt);
-            printf("no. of context switches: %ld \n\n", usage.ru_nvcsw+usage.ru_nivcsw);
-            
-            close(pd[1]);                    // close write end
-            dup2(pd[0], STDIN_FILENO);       // pd[0]  refers to STDIN_FILENO
-            execvp(inputBuf[0], inputBuf);
-
-
-            printf("Error in starting the command: %s \n", inputBuf[0]);
-            if (pd[0] != STDIN_FILENO) {
-                close(pd[0]);
-            } 
-            if (inputBuf[0][0] != '.' && inputBuf[0][0]!='/'){
-                printf("exec: : Not a basic linux command i.e. not in /usr/bin \n\n");
-            }
-            else{
-                printf("exec: : No such file or directory\n");
-                printf("Debug hint: incorrect filename, incorrect path etc.\n\n");
-            }
-            printf("monitor experienced an error in starting the command: %s \n", inputBuf[0]);
-            
-        }   
-
-        return 1;
-    }
-    //Only for the child process:
-    //Print out the termination status or the signal experienced by the child process
-    //Print out the wall clock time, user time, system time, and the number of context switches 
-    //NB: Given that the second command would be a parent process, so it will not print out the above information
-    
-    else if (pipnum > 1)// use a temporary shared file to implement the command with more than one pipes
-    {
-        char *f="temp4pipes.txt";
-        // initialize the commands with multiple pipes
-        char *mulcmd[100][100];
-        int ar=0; //index of the command
-        int a=0;//index of the argument of one command
-        for(int i=0;i<argnum;i++) {
-            if(strcmp(command[i],"!")==0) {
-                mulcmd[ar][a++]=NULL;
-                ar++;
-                a=0;
-            }
-            else mulcmd[ar][a++]=command[i];
-        }
-
-
-
-        int pid=fork();
-
-        if(pid<0) {
-            perror("fork error\n");
-            exit(0);
-        }
-        
-        if(pid==0) 
-        {
-            int icmd;//index of the currently processing command
-            for(icmd=0;icmd<pipnum;icmd++) {
-         
-                struct timeval start, end;
-                int time_used;  
-                gettimeofday(&start, NULL); // real time at the start of the program
-
-                int pid2=fork();
-
-                if(pid2<0) {
-                    perror("fork error\n");
-                    exit(0);
-                }
-                
-                else if(pid2==0) { //child process
-
-                    printf("Process with id: %d created for the command: %s \n", getpid(),mulcmd[icmd][0]);
-
-                    if(icmd>0) { //if this is not the first command, close standard input and read from file
-                        close(0); 
-                        int fd=open(f,O_RDONLY);
-                    }		
-                    close(1);
-                    remove(f);//delete the temporary file
-                    int fd=open(f,O_WRONLY|O_CREAT|O_TRUNC,0666);
-                    execvp(mulcmd[icmd][0],mulcmd[icmd]);
-
-                    //if error
-                    if (mulcmd[icmd][0][0] != '.' && mulcmd[icmd][0][0]!='/'){
-                        printf("exec: : Not a basic linux command i.e. not in /usr/bin \n\n");
-                    }
-                    else{
-                        printf("exec: : No such file or directory\n");
-                        printf("Debug hint: incorrect filename, incorrect path etc.\n\n");
-                    }
-                    printf("monitor experienced an error in starting the command: %s \n\n", mulcmd[icmd][0]);
-                    exit(1);
-                    
-                }
-                else {
-                    int status;
-                    struct rusage usage;
-                    signal(SIGINT, SIG_IGN);
-                    wait4(pid2, &status, 0, &usage);   
-
-                    gettimeofday(&end, NULL);  // real time at the end of the program
-
-                    if (WIFEXITED(status))  // if WIFEXITED(status)== true, WEXITSTATUS(status) returns the termination status
-                    {	
-                        printf("The command %s terminated with returned status code = %d\n\n", mulcmd[icmd][0],WEXITSTATUS(status));
-                    }
-                    if(WIFSIGNALED(status)){
-                        printf("The command %s is interrupted by the signal number = %d (%s)\n\n", mulcmd[icmd][0], WTERMSIG(status), sigcodeConv(WTERMSIG(status)));
-                    }  //WTERMSIG can evaluates to the number of the signal that terminated the child process if the value of WIFSIGNALED(status) is nonzero.
-                    
-
-                    printf("real: %.03f s, ",(double)(end.tv_sec + end.tv_usec / 1000000 - start.tv_sec - start.tv_usec / 1000000));
-                    printf("user: %ld.%03ld s, system: %ld.%03ld s \n",usage.ru_utime.tv_sec, usage.ru_utime.tv_usec/1000, usage.ru_stime.tv_sec, usage.ru_stime.tv_usec/1000);
-                    printf("no. of page faults: %ld \n", usage.ru_minflt+usage.ru_majflt);
-                    printf("no. of context switches: %ld \n\n", usage.ru_nvcsw+usage.ru_nivcsw);
-             
-                                                           
-                    
-                }
-            }
-            //the last command
-            close(0);
-            int fd=open(f,O_RDONLY);
-     
-            execvp(mulcmd[icmd][0],mulcmd[icmd]);
-                //if error
-            if (mulcmd[icmd][0][0] != '.' && mulcmd[icmd][0][0]!='/'){
-                printf("exec: : Not a basic linux command i.e. not in /usr/bin \n\n");
-            }
-            else{
-                printf("exec: : No such file or directory\n");
-                printf("Debug hint: incorrect filename, incorrect path etc.\n\n");
-            }
-            printf("monitor experienced an error in starting the command: %s \n\n", mulcmd[icmd][0]);
-            exit(1);           
-        }
-        
-        else {
-
-            int status;
-            struct rusage usage;
-            signal(SIGINT, SIG_IGN);
-            wait4(pid, &status, 0, &usage);   
-            if (WIFEXITED(status))  // if WIFEXITED(status)== true, WEXITSTATUS(status) returns the termination status
-            {	
-                printf("The last command %s terminated with returned status code = %d\n\n", mulcmd[pipnum][0],WEXITSTATUS(status));
-            }
-            if(WIFSIGNALED(status)){
-                printf("The last command %s is interrupted by the signal number = %d (%s)\n\n", mulcmd[pipnum][0], WTERMSIG(status), sigcodeConv(WTERMSIG(status)));
-            }  //WTERMSIG can evaluates to the number of the signal that terminated the child process if the value of WIFSIGNALED(status) is nonzero.
-            
-        }
-        return 1;
-    }
-}
-
-
-  
-void do_cmd(int argnum, char* command[]) {
-    pid_t pid;
-   
-    // recognize pipe
-    for (j = 0; j < argnum; j++) {
-        if (strcmp(command[j], "!") == 0) {
-            commandWithPipe(command);
-            return;
-        }
-    }
-
-    //for command without pipe
-    struct timeval start, end;
-    int time_used;  
-    
-    gettimeofday(&start, NULL); // real time at the start of the program
-    switch(pid = fork()) {
-        case -1:
-            printf("Child process creation failed");
-            return;
-
-        case 0: // Child process
-                
-                printf("Process with id: %d created for the command: %s \n", getpid(),command[0]);
-
-                execvp(command[0], command); //after testing, all three situations can be handled well with execvp()
-                if (command[0][0] != '.' && command[0][0]!='/'){
-                    printf("exec: : Not a basic linux command i.e. not in /usr/bin \n\n");
-                }
-                else{
-                    printf("exec: : No such file or directory\n");
-                    printf("Debug hint: incorrect filename, incorrect path etc.\n\n");
-                }
-                printf("monitor experienced an error in starting the command: %s \n\n", command[0]);
-                exit(1);// output error(1) and terminate the process 
-
-        default: { //parent process
-                int status;
-                struct rusage usage;
-                signal(SIGINT, SIG_IGN);
-                wait4(pid, &status, 0, &usage);
-                
-                gettimeofday(&end, NULL);  // real time at the end of the program
-                if (WIFEXITED(status))  // if WIFEXITED(status)== true, WEXITSTATUS(status) returns the termination status
-                {	
-                    printf("The command %s terminated with returned status code = %d\n\n", command[0],WEXITSTATUS(status));
-                }
-                if(WIFSIGNALED(status)){
-                    printf("The command %s is interrupted by the signal number = %d (%s)\n\n", command[0], WTERMSIG(status), sigcodeConv(WTERMSIG(status)));
-                }  //WTERMSIG can evaluates to the number of the signal that terminated the child process if the value of WIFSIGNALED(status) is nonzero.
-                
-
-                printf("real: %.03f s, ",(double)(end.tv_sec + end.tv_usec / 1000000 - start.tv_sec - start.tv_usec / 1000000));
-                printf("user: %ld.%03ld s, system: %ld.%03ld s \n",usage.ru_utime.tv_sec, usage.ru_utime.tv_usec/1000, usage.ru_stime.tv_sec, usage.ru_stime.tv_usec/1000);
-                printf("no. of page faults: %ld \n", usage.ru_minflt+usage.ru_majflt);
-                printf("no. of context switches: %ld \n\n", usage.ru_nvcsw+usage.ru_nivcsw);
-                      
-        }
-    
-    }
-	
-}
-
-int main(int argc, char *argv[]) {
-
-    if (argc == 1) {exit(0);} 
-    argnum = argc-1;
-    for (i = 0; i < argnum; i++) {
-        command[i]= argv[i+1] ;
-        }                    // build command
-    do_cmd(argnum, command); // implement command
-    return 0;
-} // main
+//Filename: monitor.c
+
+#define _GNU_SOURCE                             // splice(), F_SETPIPE_SZ
+
+//Development platform: WSL
+//Remark: The running statistics of every command are reported, including the last command with pipes
+//        e.g. the running statistics of "wc -c"  in " cat m.c ! grep io ! wc -c "
+// Basically, I handle this assignment with 2 cases 
+// 1. without pipe: execve
+// 2. with pipes: all the commands run at the same time, connected by a chain of N-1 pipes, and the parent reaps them all 
+// Every command is reported as soon as it terminates (pidfd + epoll reaper, waitid loop as fallback),
+// followed by the total of the pipeline and the command that used most of the CPU
+// Every command is resolved against PATH (cached) before anything is forked, then started with execve()
+// --spawn launches the commands with posix_spawn() (vfork semantics), --launch-bench compares it with fork+exec
+// --batch FILE -j N runs a file of command lines with at most N of them at the same time
+// --runs N --warmup K repeats the command line and prints percentiles of every statistic
+// all times come from CLOCK_MONOTONIC with microsecond precision, --format json|csv writes one record per process
+// --sample MS samples CPU%, RSS and I/O of every running command from /proc (timerfd in the reaper's epoll set)
+// --perf attaches perf_event_open counters to every command before its exec (a per-command perf stat)
+// --tree makes monitor a child subreaper and accounts for every descendant of the commands
+// --serve SOCKET keeps pre-forked launchers on a Unix domain socket and answers every command line with json records
+// (sent by --client as NUL-terminated arguments; the commands themselves write to the server's stdout)
+// @cpus=LIST @nice=N @sched=batch in front of a command pin it and set its priority; the CPU it finished on
+// and its migrations are reported
+// --relay puts a splice() relay thread on every '!' to count bytes, throughput and pipe stalls
+
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+#include <linux/perf_event.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sched.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434                      // pidfd_open(2) on kernels newer than the libc headers
+#endif
+
+
+int argnum;                                     // number of the input argument
+// char* argv[1000];                            // input argument array
+char* command[1000];                            // the whole command
+int i, j;                                       // variable for looping
+
+
+char* sigcodeConv(int sig) {// convert signal codes to standardized signal names
+    switch(sig){
+        case 1 : return "SIGHUP";
+        case 2 : return "SIGINT";
+        case 3 : return "SIGQUIT";
+        case 4 : return "SIGILL";
+        case 5 : return "SIGTRAP";
+        case 6 : return "SIGABRT or SIGIOT";
+        case 7 : return "SIGBUS";
+        case 8 : return "SIGFPE";
+        case 9 : return "SIGKILL";
+        case 10 : return "SIGUSR1";
+        case 11 : return "SIGSEGV";
+        case 12 : return "SIGUSR2";
+        case 13 : return "SIGPIPE";
+        case 14 : return "SIGALRM";
+        case 15 : return "SIGTERM";
+        case 16 : return "SIGSTKFLT";
+        case 17 : return "SIGCHLD";
+        case 18 : return "SIGCONT";
+        case 19 : return "SIGSTOP";
+        case 20 : return "SIGTSTP";
+        case 21 : return "SIGTTIN";
+        case 22 : return "SIGTTOU";
+        case 23 : return "SIGURG";
+        case 24 : return "SIGXCPU";
+        case 25 : return "SIGXFSZ";
+        case 26 : return "SIGVTALRM";
+        case 27 : return "SIGPROF";
+        case 28 : return "SIGWINCH  ";
+        case 29 : return "SIGIO or SIGPOLL";
+        case 30 : return "SIGPWR";
+        case 31 : return "SIGSYS or SIGUNUSED";
+
+     return "Unknown signal code";
+ }
+}
+
+#define MAX_STAGES 100                          // upper bound of commands in one pipeline
+#define NPERF 10                                // counters opened per command with --perf
+
+// --perf counters: the hardware events first, the software events always work without a PMU
+struct perfEvent { unsigned type; unsigned long long config; const char *name; } perfEvents[NPERF] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, "cache-references"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, "branches"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"},
+};
+enum {P_CYCLES, P_INSTR, P_CREF, P_CMISS, P_BRANCH, P_BMISS, P_TASKCLOCK, P_MIGRATIONS, P_CSWITCH, P_FAULTS};
+
+struct stage {
+    char **argv;                                // NULL-terminated argument list of the command
+    pid_t pid;                                  // process id of the running command
+    int status;                                 // termination status returned by wait4
+    struct rusage usage;                        // running statistics returned by wait4
+    char *path;                                 // executable resolved against PATH before anything is forked
+    struct timespec start, end;                 // CLOCK_MONOTONIC time at launch and at reap
+    int reaped;                                 // 1 once wait4 has collected the command
+    int index;                                  // position of the command in the pipeline
+    int job;                                    // line number of the --batch job, 0 otherwise
+    // live samples from /proc while the command runs (--sample)
+    long peakRss;                               // kB, the larger of the sampled VmRSS and VmHWM
+    double peakCpu;                             // percent of one CPU between two samples
+    long long rchar, wchar;                     // bytes passed to read/write system calls
+    long long readBytes, writeBytes;            // bytes fetched from / sent to the storage layer
+    long long cpuNs;                            // CPU time at the last sample
+    struct timespec sampled;                    // time of the last sample
+    // --perf counters, opened on the child before its exec
+    int perfFd[NPERF];                          // -1 when the event is not available
+    double perf[NPERF];                         // final values scaled for multiplexing, -1 when not available
+    // placement from the @ tokens in front of the command
+    int placed;                                 // 1 when any of the following is set
+    int hasCpus;                                // @cpus=LIST: allowed CPUs
+    cpu_set_t cpus;
+    int hasNice, nice;                          // @nice=N
+    int policy;                                 // @sched=other|batch|idle, -1 to keep the policy of monitor
+    int lastCpu;                                // CPU the command last ran on, -1 if unknown
+    long migrations;                            // se.nr_migrations from /proc/<pid>/sched, -1 if unknown
+};
+
+struct edge {                                   // relay between command k and command k+1 (--relay)
+    int in, out;                                // read end of the writer's pipe, write end of the reader's pipe
+    int capacity;                               // pipe capacity in bytes
+    pthread_t tid;                              // relay thread
+    long long bytes;                            // bytes moved through the relay
+    double elapsed;                             // seconds from the start of the relay to the end of file
+    double stallEmpty, stallFull;               // seconds blocked on an empty input or a full output pipe
+};
+
+int relayMode = 0;                              // --relay: splice the data between the commands through monitor
+int pipeSize = 0;                               // --pipe-size: capacity of every pipe, 0 for the default
+int spawnMode = 0;                              // --spawn: start the commands with posix_spawn() instead of fork()
+int benchRuns = 0;                              // --launch-bench: number of launches per backend
+int ballastMB = 0;                              // --ballast: MB of memory touched before --launch-bench
+char *batchFile = NULL;                         // --batch: file of command lines, "-" for stdin
+int maxJobs = 1;                                // -j: number of command lines running at the same time
+int reportOnReap = 1;                           // print every command as soon as it is reaped
+int runs = 0;                                   // --runs: number of recorded repetitions
+int warmup = 0;                                 // --warmup: number of repetitions before recording
+int format = 0;                                 // --format: 0 text, 1 json, 2 csv
+FILE *statsOut;                                 // --output: where the json/csv records go, stdout by default
+int csvHeader = 0;                              // 1 once the csv header line has been written
+FILE *summaryOut;                               // batch, repeat and tree summaries: stdout, or stderr with json/csv
+int sampleMs = 0;                               // --sample: interval of the /proc sampler in ms, 0 for off
+FILE *timeline = NULL;                          // --timeline: csv file of every sample
+struct timespec sampleOrigin;                   // time 0 of the timeline
+int perfMode = 0;                               // --perf: per-command perf_event_open counters
+int treeMode = 0;                               // --tree: account for every descendant as a child subreaper
+int serveWorkers = 2;                           // --workers: launchers forked by --serve
+
+void now(struct timespec *t) {// monotonic wall clock, immune to settimeofday and NTP steps
+    clock_gettime(CLOCK_MONOTONIC, t);
+}
+
+double elapsedSec(struct timespec *from, struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+double tvSec(struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+#define PATH_CACHE 256                          // buckets of the PATH lookup cache
+
+struct pathEntry {                              // one cached lookup: command name -> executable
+    char *name, *path;
+    struct pathEntry *next;
+};
+
+struct pathEntry *pathCache[PATH_CACHE];        // shared by every command line of --batch and every run of --runs
+
+// find the executable of a command like execvp() would, once per name: a name with '/' is used as it is,
+// otherwise the first executable regular file in the directories of PATH
+// a miss is not cached, a long-running --serve or --batch finds a command installed later
+char *resolveCommand(const char *name) {
+    struct pathEntry *pe;
+    struct stat sb;
+    const char *dirs, *end;
+    char buf[4096];
+    unsigned h = 5381;
+    int len;
+
+    for (end = name; *end; end++)
+        h = h * 33 + (unsigned char)*end;
+    for (pe = pathCache[h % PATH_CACHE]; pe != NULL; pe = pe->next) {
+        if (strcmp(pe->name, name) == 0)
+            return pe->path;
+    }
+
+    pe = malloc(sizeof(*pe));
+    pe->name = strdup(name);
+    pe->path = NULL;
+    if (strchr(name, '/') != NULL) {
+        if (access(name, X_OK) == 0 && stat(name, &sb) == 0 && S_ISREG(sb.st_mode))
+            pe->path = strdup(name);
+    }
+    else if (*name != '\0') {
+        dirs = getenv("PATH");
+        if (dirs == NULL)
+            dirs = "/usr/local/bin:/usr/bin:/bin";
+        for (; pe->path == NULL; dirs = end + 1) {
+            end = strchr(dirs, ':');
+            if (end == NULL)
+                end = dirs + strlen(dirs);
+            len = end - dirs;
+            if (len == 0)
+                snprintf(buf, sizeof(buf), "./%s", name); // an empty entry is the current directory
+            else
+                snprintf(buf, sizeof(buf), "%.*s/%s", len, dirs, name);
+            if (access(buf, X_OK) == 0 && stat(buf, &sb) == 0 && S_ISREG(sb.st_mode))
+                pe->path = strdup(buf);
+            if (*end == '\0')
+                break;
+        }
+    }
+    if (pe->path == NULL) {
+        free(pe->name);
+        free(pe);
+        return NULL;
+    }
+    pe->next = pathCache[h % PATH_CACHE];
+    pathCache[h % PATH_CACHE] = pe;
+    return pe->path;
+}
+
+void printExecError(char *cmd);
+
+int parseCpuList(const char *list, cpu_set_t *set) {// "0-3,8" -> CPU set, returns 0 on a syntax error
+    char *end;
+    long lo, hi;
+
+    CPU_ZERO(set);
+    while (*list) {
+        lo = hi = strtol(list, &end, 10);
+        if (end == list || lo < 0)
+            return 0;
+        if (*end == '-') {
+            list = end + 1;
+            hi = strtol(list, &end, 10);
+            if (end == list || hi < lo)
+                return 0;
+        }
+        for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+            CPU_SET(lo, set);
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return 0;
+        list = end;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+// consume the @ tokens in front of a command: @cpus=LIST, @nice=N, @sched=other|batch|idle
+int parsePlacement(struct stage *st) {
+    char *tok;
+
+    st->policy = -1;
+    for (; (tok = st->argv[0]) != NULL && tok[0] == '@'; st->argv++) {
+        st->placed = 1;
+        if (strncmp(tok, "@cpus=", 6) == 0 && parseCpuList(tok + 6, &st->cpus))
+            st->hasCpus = 1;
+        else if (strncmp(tok, "@nice=", 6) == 0) {
+            st->hasNice = 1;
+            st->nice = atoi(tok + 6);
+        }
+        else if (strcmp(tok, "@sched=other") == 0)
+            st->policy = SCHED_OTHER;
+        else if (strcmp(tok, "@sched=batch") == 0)
+            st->policy = SCHED_BATCH;
+        else if (strcmp(tok, "@sched=idle") == 0)
+            st->policy = SCHED_IDLE;
+        else {
+            printf("monitor: unknown placement %s (@cpus=LIST, @nice=N, @sched=other|batch|idle)\n", tok);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// apply the placement of a command to the calling process, between fork() and exec
+void applyPlacement(struct stage *st) {
+    struct sched_param param = {0};
+
+    if (st->hasCpus && sched_setaffinity(0, sizeof(cpu_set_t), &st->cpus) < 0)
+        perror("sched_setaffinity()");
+    if (st->policy >= 0 && sched_setscheduler(0, st->policy, &param) < 0)
+        perror("sched_setscheduler()");
+    if (st->hasNice && setpriority(PRIO_PROCESS, 0, st->nice) < 0)
+        perror("setpriority()");
+}
+
+// split the command at every logic pipe '!' into NULL-terminated argument lists
+// and resolve the executable of every command, so a typo fails before any command is started
+// cmdbuf must hold argnum+1 entries, the '!' are replaced by NULL in cmdbuf
+int parsePipeline(int argnum, char *command[], char *cmdbuf[], struct stage stages[]) {
+    int nstage = 0;
+
+    memset(stages, 0, sizeof(struct stage));
+    stages[nstage++].argv = &cmdbuf[0];
+    for (j = 0; j < argnum; j++) {
+        if (strcmp(command[j], "!") == 0) {
+            cmdbuf[j] = NULL;
+            if (nstage == MAX_STAGES) {
+                printf("monitor: too many pipes (at most %d commands)\n", MAX_STAGES);
+                return -1;
+            }
+            memset(&stages[nstage], 0, sizeof(struct stage));
+            stages[nstage].index = nstage;
+            stages[nstage++].argv = &cmdbuf[j + 1];
+        }
+        else cmdbuf[j] = command[j];
+    }
+    cmdbuf[argnum] = NULL;
+
+    for (i = 0; i < nstage; i++) {
+        if (!parsePlacement(&stages[i]))
+            return -1;
+        if (stages[i].argv[0] == NULL) {
+            printf("monitor: empty command in the pipeline\n");
+            return -1;
+        }
+    }
+    for (i = 0; i < nstage; i++) {
+        stages[i].path = resolveCommand(stages[i].argv[0]);
+        if (stages[i].path == NULL) {
+            printExecError(stages[i].argv[0]);
+            return -1;
+        }
+    }
+    return nstage;
+}
+
+void printExecError(char *cmd) {// print the hints after a failed lookup or exec
+    if (cmd[0] != '.' && cmd[0] != '/') {
+        fprintf(stderr, "exec: : Not a basic linux command i.e. not in /usr/bin \n\n");
+    }
+    else {
+        fprintf(stderr, "exec: : No such file or directory\n");
+        fprintf(stderr, "Debug hint: incorrect filename, incorrect path etc.\n\n");
+    }
+    fprintf(stderr, "monitor experienced an error in starting the command: %s \n\n", cmd);
+}
+
+// open the --perf counters on a child that is blocked before its exec:
+// enable_on_exec starts counting at the exec of the command, inherit adds the processes it forks
+void openPerf(struct stage *st) {
+    struct perf_event_attr attr;
+    int e;
+
+    for (e = 0; e < NPERF; e++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perfEvents[e].type;
+        attr.config = perfEvents[e].config;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.inherit = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        st->perfFd[e] = syscall(SYS_perf_event_open, &attr, st->pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (st->perfFd[e] < 0 && attr.type == PERF_TYPE_HARDWARE) {
+            attr.exclude_kernel = 1; // perf_event_paranoid 2 still allows user-space counting
+            st->perfFd[e] = syscall(SYS_perf_event_open, &attr, st->pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        }
+    } // a hardware event fails without a PMU (e.g. in most VMs), the software events remain
+}
+
+// read and close the counters of a terminated command
+void readPerf(struct stage *st) {
+    unsigned long long v[3]; // value, time enabled, time running
+    int e;
+
+    for (e = 0; e < NPERF; e++) {
+        st->perf[e] = -1;
+        if (st->perfFd[e] < 0)
+            continue;
+        if (read(st->perfFd[e], v, sizeof(v)) == sizeof(v))
+            st->perf[e] = v[2] > 0 ? (double)v[0] * v[1] / v[2] : 0.0; // scale if the PMU was multiplexed
+        close(st->perfFd[e]);
+        st->perfFd[e] = -1;
+    }
+}
+
+void printPerf(struct stage *st) {// print the counters and the derived ratios of one command
+    double *c = st->perf;
+    int e;
+
+    if (format == 1) {
+        fprintf(statsOut, "{\"type\":\"perf\",\"job\":%d,\"stage\":%d,\"pid\":%d", st->job, st->index, (int)st->pid);
+        for (e = 0; e < NPERF; e++) {
+            if (c[e] >= 0)
+                fprintf(statsOut, ",\"%s\":%.0f", perfEvents[e].name, c[e]);
+        }
+        if (c[P_CYCLES] > 0 && c[P_INSTR] >= 0)
+            fprintf(statsOut, ",\"ipc\":%.3f", c[P_INSTR] / c[P_CYCLES]);
+        if (c[P_CREF] > 0 && c[P_CMISS] >= 0)
+            fprintf(statsOut, ",\"cache_miss_rate\":%.4f", c[P_CMISS] / c[P_CREF]);
+        if (c[P_BRANCH] > 0 && c[P_BMISS] >= 0)
+            fprintf(statsOut, ",\"branch_miss_rate\":%.4f", c[P_BMISS] / c[P_BRANCH]);
+        fprintf(statsOut, "}\n");
+        fflush(statsOut);
+        return;
+    }
+    if (format == 2)
+        return;
+
+    if (c[P_CYCLES] >= 0 && c[P_INSTR] >= 0)
+        printf("cycles: %.0f, instructions: %.0f, IPC: %.2f \n", c[P_CYCLES], c[P_INSTR], c[P_CYCLES] > 0 ? c[P_INSTR] / c[P_CYCLES] : 0.0);
+    else
+        printf("cycles, instructions: not supported (no hardware PMU), software counters only \n");
+    if (c[P_CMISS] >= 0)
+        printf("cache misses: %.0f (%.2f%% of %.0f references) \n", c[P_CMISS], c[P_CREF] > 0 ? 100.0 * c[P_CMISS] / c[P_CREF] : 0.0, c[P_CREF]);
+    if (c[P_BMISS] >= 0)
+        printf("branch misses: %.0f (%.2f%% of %.0f branches) \n", c[P_BMISS], c[P_BRANCH] > 0 ? 100.0 * c[P_BMISS] / c[P_BRANCH] : 0.0, c[P_BRANCH]);
+    printf("task-clock: %.3f ms, cpu-migrations: %.0f, context-switches: %.0f, page-faults: %.0f \n",
+           c[P_TASKCLOCK] / 1e6, c[P_MIGRATIONS], c[P_CSWITCH], c[P_FAULTS]);
+}
+
+void printJsonString(const char *str) {// write a quoted and escaped JSON string
+    fputc('"', statsOut);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(statsOut, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(statsOut, "\\u%04x", *str);
+        else
+            fputc(*str, statsOut);
+    }
+    fputc('"', statsOut);
+}
+
+void printCsvString(const char *str) {// write a quoted CSV field, doubling the quotes
+    fputc('"', statsOut);
+    for (; *str; str++) {
+        if (*str == '"')
+            fputc('"', statsOut);
+        fputc(*str, statsOut);
+    }
+    fputc('"', statsOut);
+}
+
+// write one json/csv record: type is "process" for a command, "pipeline" for the total of a pipeline
+void printRecord(const char *type, int job, int index, pid_t pid, const char *cmd, int status,
+                 double real, double user, double sys, long minflt, long majflt, long nvcsw, long nivcsw,
+                 int lastCpu, long migrations) {
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    int sig = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+
+    if (format == 1) {
+        fprintf(statsOut, "{\"type\":\"%s\",\"job\":%d,\"stage\":%d,\"pid\":%d,\"command\":", type, job, index, (int)pid);
+        printJsonString(cmd);
+        fprintf(statsOut, ",\"exit_status\":%d,\"signal\":%d,\"real_s\":%.6f,\"user_s\":%.6f,\"sys_s\":%.6f,"
+                "\"minflt\":%ld,\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld,\"last_cpu\":%d,\"migrations\":%ld}\n",
+                code, sig, real, user, sys, minflt, majflt, nvcsw, nivcsw, lastCpu, migrations);
+    }
+    else {
+        if (!csvHeader) {
+            fprintf(statsOut, "type,job,stage,pid,command,exit_status,signal,real_s,user_s,sys_s,minflt,majflt,nvcsw,nivcsw,last_cpu,migrations\n");
+            csvHeader = 1;
+        }
+        fprintf(statsOut, "%s,%d,%d,%d,", type, job, index, (int)pid);
+        printCsvString(cmd);
+        fprintf(statsOut, ",%d,%d,%.6f,%.6f,%.6f,%ld,%ld,%ld,%ld,%d,%ld\n",
+                code, sig, real, user, sys, minflt, majflt, nvcsw, nivcsw, lastCpu, migrations);
+    }
+    fflush(statsOut);
+}
+
+void printStage(struct stage *st) {// print the termination status and running statistics of one command
+    if (format != 0) {
+        printRecord("process", st->job, st->index, st->pid, st->argv[0], st->status, elapsedSec(&st->start, &st->end),
+                    tvSec(&st->usage.ru_utime), tvSec(&st->usage.ru_stime), st->usage.ru_minflt, st->usage.ru_majflt,
+                    st->usage.ru_nvcsw, st->usage.ru_nivcsw, st->lastCpu, st->migrations);
+        if (format == 1 && sampleMs > 0) {
+            fprintf(statsOut, "{\"type\":\"peaks\",\"job\":%d,\"stage\":%d,\"pid\":%d,\"peak_rss_kb\":%ld,\"peak_cpu_pct\":%.1f,"
+                    "\"rchar\":%lld,\"wchar\":%lld,\"read_bytes\":%lld,\"write_bytes\":%lld}\n",
+                    st->job, st->index, (int)st->pid, st->peakRss, st->peakCpu, st->rchar, st->wchar, st->readBytes, st->writeBytes);
+            fflush(statsOut);
+        }
+        if (perfMode && st->pid > 0)
+            printPerf(st);
+        return;
+    }
+
+    if (WIFEXITED(st->status))  // if WIFEXITED(status)== true, WEXITSTATUS(status) returns the termination status
+    {
+        printf("The command %s terminated with returned status code = %d\n\n", st->argv[0], WEXITSTATUS(st->status));
+    }
+    if (WIFSIGNALED(st->status)) {
+        printf("The command %s is interrupted by the signal number = %d (%s)\n\n", st->argv[0], WTERMSIG(st->status), sigcodeConv(WTERMSIG(st->status)));
+    }  //WTERMSIG can evaluates to the number of the signal that terminated the child process if the value of WIFSIGNALED(status) is nonzero.
+
+    printf("real: %.06f s, ", elapsedSec(&st->start, &st->end));
+    printf("user: %ld.%06ld s, system: %ld.%06ld s \n", st->usage.ru_utime.tv_sec, st->usage.ru_utime.tv_usec, st->usage.ru_stime.tv_sec, st->usage.ru_stime.tv_usec);
+    printf("no. of page faults: %ld \n", st->usage.ru_minflt+st->usage.ru_majflt);
+    printf("no. of context switches: %ld \n", st->usage.ru_nvcsw+st->usage.ru_nivcsw);
+    if (st->lastCpu >= 0)
+        printf("last CPU: %d, no. of CPU migrations: %ld \n", st->lastCpu, st->migrations);
+    if (sampleMs > 0) {
+        printf("peak RSS: %ld kB, peak CPU: %.1f%% \n", st->peakRss, st->peakCpu);
+        printf("read: %lld bytes (storage %lld), written: %lld bytes (storage %lld) \n", st->rchar, st->readBytes, st->wchar, st->writeBytes);
+    }
+    if (perfMode && st->pid > 0)
+        printPerf(st);
+    printf("\n");
+}
+
+// relay between two commands: move the data from the pipe of the writer to the pipe of the reader
+// with splice(), so the bytes never pass through user space, and count where the data backs up
+void *relayEdge(void *arg) {
+    struct edge *e = (struct edge *)arg;
+    struct timespec t0, t1, begin, finish;
+    struct pollfd pfd;
+    ssize_t n;
+    int full;
+
+    now(&begin);
+    for (;;) {
+        n = splice(e->in, NULL, e->out, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            e->bytes += n;
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            break; // end of file from the writer, or the reader is gone (EPIPE)
+        if (errno == EINTR)
+            continue;
+
+        // nothing moved: either the input pipe is empty or the output pipe is full
+        pfd.fd = e->in;
+        pfd.events = POLLIN;
+        full = poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+        if (full) {
+            pfd.fd = e->out;
+            pfd.events = POLLOUT;
+        }
+        now(&t0);
+        poll(&pfd, 1, -1);
+        now(&t1);
+        if (full)
+            e->stallFull += elapsedSec(&t0, &t1);
+        else
+            e->stallEmpty += elapsedSec(&t0, &t1);
+        if (full && (pfd.revents & (POLLERR | POLLHUP)))
+            break; // the reader is gone
+    }
+    now(&finish);
+    e->elapsed = elapsedSec(&begin, &finish);
+
+    close(e->in);  // the writer gets SIGPIPE if it is still running
+    close(e->out); // the reader gets end of file
+    return NULL;
+}
+
+void printEdge(struct edge *e, struct stage *from, struct stage *to) {// print the counters of one relay
+    if (format == 1) {
+        fprintf(statsOut, "{\"type\":\"pipe\",\"job\":%d,\"stage\":%d,\"bytes\":%lld,\"elapsed_s\":%.6f,"
+                "\"capacity\":%d,\"stall_empty_s\":%.6f,\"stall_full_s\":%.6f}\n",
+                from->job, from->index, e->bytes, e->elapsed, e->capacity, e->stallEmpty, e->stallFull);
+        return;
+    }
+    if (format == 2)
+        return; // the csv records have one fixed set of columns, the pipes only exist in text and json
+    printf("The pipe statistics for %s ! %s as follows: \n", from->argv[0], to->argv[0]);
+    printf("bytes: %lld, throughput: %.03f MB/s, pipe capacity: %d bytes \n", e->bytes,
+           e->elapsed > 0 ? e->bytes / e->elapsed / 1000000.0 : 0.0, e->capacity);
+    printf("stall: input empty %.03f s, output full %.03f s \n\n", e->stallEmpty, e->stallFull);
+}
+
+// create a pipe, resized to pipeSize bytes if requested; returns the capacity
+// both ends are close-on-exec: a command keeps only the ends dup2'ed onto its stdin/stdout, so the commands of
+// another --batch job forked while this one runs never hold its pipes (or relay pipes) open
+int makePipe(int pd[2]) {
+    if (pipe2(pd, O_CLOEXEC) < 0) {
+        perror("pipe2()");
+        exit(1);
+    }
+    if (pipeSize > 0 && fcntl(pd[1], F_SETPIPE_SZ, pipeSize) < 0)
+        perror("fcntl(F_SETPIPE_SZ)");
+    return fcntl(pd[1], F_GETPIPE_SZ);
+}
+
+// start one command reading from fd in and writing to fd out, closing the pipe ends in fds[]
+// fork()+execve() by default, posix_spawn() with --spawn: glibc implements it with clone(CLONE_VM|CLONE_VFORK),
+// so the page tables of monitor are never copied
+void launchStage(struct stage *st, int in, int out, int fds[], int nfds) {
+    int gate[2];
+
+    now(&st->start); // monotonic time at the start of the command
+    st->reaped = 0;
+    st->peakRss = 0; // the sampler starts over, --runs and --serve launch the same stage again
+    st->peakCpu = 0.0;
+    st->cpuNs = 0;
+    st->rchar = st->wchar = st->readBytes = st->writeBytes = 0;
+
+    if (spawnMode && !perfMode && !st->placed) { // the counters and the placement need the child before its exec
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t attr;
+        sigset_t sigdef;
+        int err;
+
+        posix_spawn_file_actions_init(&actions);
+        if (in != STDIN_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+        if (out != STDOUT_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+        for (i = 0; i < nfds; i++)
+            posix_spawn_file_actions_addclose(&actions, fds[i]);
+
+        posix_spawnattr_init(&attr);
+        sigemptyset(&sigdef);
+        sigaddset(&sigdef, SIGINT);
+        sigaddset(&sigdef, SIGPIPE); // monitor ignores both, the command must not inherit that
+        posix_spawnattr_setsigdefault(&attr, &sigdef);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+        err = posix_spawn(&st->pid, st->path, &actions, &attr, st->argv, environ);
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+
+        if (err != 0) { // the exec failure is reported here, there is no process to reap
+            printExecError(st->argv[0]);
+            st->pid = -1;
+            st->status = 1 << 8; // same as a child that calls exit(1)
+            st->lastCpu = -1;
+            memset(&st->usage, 0, sizeof(st->usage));
+            now(&st->end);
+            st->reaped = 1;
+            if (reportOnReap)
+                printStage(st);
+            return;
+        }
+        if (format == 0)
+            printf("Process with id: %d created for the command: %s \n", st->pid, st->argv[0]);
+        return;
+    }
+
+    if (perfMode && pipe2(gate, O_CLOEXEC) < 0) {
+        perror("pipe2()");
+        exit(1);
+    }
+
+    st->pid = fork();
+    if (st->pid < 0) {
+        perror("fork()");
+        exit(1);
+    }
+
+    if (perfMode && st->pid > 0) { // let the child exec once its counters are attached
+        close(gate[0]);
+        openPerf(st);
+        close(gate[1]);
+    }
+
+    if (st->pid == 0) { // child process
+        if (format == 0) {
+            printf("Process with id: %d created for the command: %s \n", getpid(), st->argv[0]);
+            fflush(stdout);
+        }
+        signal(SIGINT, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL); // monitor ignores both, the command must not inherit that
+
+        if (in != STDIN_FILENO)
+            dup2(in, STDIN_FILENO);
+        if (out != STDOUT_FILENO)
+            dup2(out, STDOUT_FILENO);
+        for (i = 0; i < nfds; i++)
+            close(fds[i]);
+        if (st->placed)
+            applyPlacement(st);
+        if (perfMode) {
+            char c;
+            close(gate[1]);
+            while (read(gate[0], &c, 1) < 0 && errno == EINTR)
+                ; // end of file once monitor has opened the counters
+        }
+
+        execve(st->path, st->argv, environ);
+        printExecError(st->argv[0]);
+        _exit(1); // exit() would flush and rewind the stdio streams shared with monitor
+    }
+}
+
+// start all the commands of a pipeline at the same time, connected by a chain of pipes:
+// the output of command k is the write end of pipe k, the input of command k+1 is the read end of pipe k
+// in relay mode, edge k has a second pipe rp[k] and a relay thread moving the data from pd[k] to rp[k]
+void startPipeline(struct stage stages[], int nstage, struct edge edges[]) {
+    int pd[MAX_STAGES - 1][2], rp[MAX_STAGES - 1][2];
+    int pipefds[4 * MAX_STAGES], npipefds = 0;
+    int k;
+
+    for (k = 0; k < nstage - 1; k++) {
+        edges[k].capacity = makePipe(pd[k]);
+        if (relayMode)
+            makePipe(rp[k]);
+    } // create the N-1 pipes before any fork so that every command can inherit them
+
+    for (k = 0; k < nstage - 1; k++) {
+        pipefds[npipefds++] = pd[k][0];
+        pipefds[npipefds++] = pd[k][1];
+        if (relayMode) {
+            pipefds[npipefds++] = rp[k][0];
+            pipefds[npipefds++] = rp[k][1];
+        }
+    } // every command closes all of them, otherwise the readers never see end of file
+
+    fflush(stdout); // do not let the children inherit buffered output
+    for (k = 0; k < nstage; k++) {
+        launchStage(&stages[k],
+                    k > 0 ? (relayMode ? rp[k - 1][0] : pd[k - 1][0]) : STDIN_FILENO,  // read from the previous command
+                    k < nstage - 1 ? pd[k][1] : STDOUT_FILENO,                          // write to the next command
+                    pipefds, npipefds);
+    }
+
+    // parent process keeps no pipe end open, except the ends used by the relays
+    signal(SIGPIPE, SIG_IGN); // a relay writing to a terminated reader gets EPIPE instead
+    for (k = 0; k < nstage - 1; k++) {
+        close(pd[k][1]);
+        if (relayMode) {
+            close(rp[k][0]);
+            edges[k].in = pd[k][0];
+            edges[k].out = rp[k][1];
+            edges[k].bytes = 0;
+            edges[k].stallEmpty = edges[k].stallFull = edges[k].elapsed = 0.0;
+            pthread_create(&edges[k].tid, NULL, relayEdge, &edges[k]);
+        }
+        else close(pd[k][0]);
+    }
+}
+
+// read a small /proc file into buf, returns the number of bytes or -1
+int readProc(pid_t pid, const char *name, char *buf, int size) {
+    char path[64];
+    int fd, n;
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+long long procField(const char *buf, const char *key) {// value after "key" in a /proc key: value file
+    const char *p = strstr(buf, key);
+
+    return p ? atoll(p + strlen(key)) : -1;
+}
+
+// the CPU a command last ran on and how often the scheduler moved it, read from /proc/<pid> before it is reaped
+void readPlacement(struct stage *st) {
+    char buf[8192], *p;
+
+    st->lastCpu = -1;
+    st->migrations = -1;
+    if (readProc(st->pid, "stat", buf, sizeof(buf)) > 0 && (p = strrchr(buf, ')')) != NULL)
+        sscanf(p + 2, "%*c" "%*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %*u %*u %*d"
+               " %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d", &st->lastCpu); // field 39: processor
+    if (readProc(st->pid, "sched", buf, sizeof(buf)) > 0 && (p = strstr(buf, "se.nr_migrations")) != NULL
+        && (p = strchr(p, ':')) != NULL)
+        st->migrations = atol(p + 1);
+}
+
+// collect the termination status and rusage of a terminated command, then report it
+void reapStage(struct stage *st, int options) {
+    readPlacement(st); // from the zombie, before wait4 releases it
+    if (wait4(st->pid, &st->status, options, &st->usage) != st->pid)
+        return;
+    now(&st->end);  // monotonic time at the end of the command
+    st->reaped = 1;
+    if (perfMode)
+        readPerf(st);
+    if (reportOnReap)
+        printStage(st);
+}
+
+// take one sample of a running command: CPU% since the last sample, RSS and I/O counters
+void sampleStage(struct stage *st, struct timespec *t) {
+    char buf[4096], *p;
+    long long cpuNs = -1, rss = 0, v;
+    double cpu, dt;
+
+    if (readProc(st->pid, "schedstat", buf, sizeof(buf)) > 0)
+        cpuNs = atoll(buf); // nanoseconds on the CPU
+    else if (readProc(st->pid, "stat", buf, sizeof(buf)) > 0 && (p = strrchr(buf, ')')) != NULL) {
+        unsigned long ut, stm;
+        if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &ut, &stm) == 2)
+            cpuNs = (ut + stm) * (1000000000LL / sysconf(_SC_CLK_TCK)); // clock ticks, without schedstat
+    }
+    if (cpuNs < 0)
+        return; // already gone
+
+    dt = elapsedSec(&st->sampled, t);
+    cpu = dt > 0 ? (cpuNs - st->cpuNs) / 1e9 / dt * 100.0 : 0.0;
+    if (cpu > st->peakCpu)
+        st->peakCpu = cpu;
+    st->cpuNs = cpuNs;
+    st->sampled = *t;
+
+    if (readProc(st->pid, "status", buf, sizeof(buf)) > 0) {
+        if ((rss = procField(buf, "VmRSS:")) > st->peakRss)
+            st->peakRss = rss;
+        if ((v = procField(buf, "VmHWM:")) > st->peakRss)
+            st->peakRss = v;
+    }
+    if (readProc(st->pid, "io", buf, sizeof(buf)) > 0) {
+        st->rchar = procField(buf, "rchar:");
+        st->wchar = procField(buf, "wchar:");
+        st->readBytes = procField(buf, "\nread_bytes:");
+        st->writeBytes = procField(buf, "\nwrite_bytes:");
+    }
+
+    if (timeline != NULL) {
+        fprintf(timeline, "%.6f,%d,%d,%s,%.1f,%lld,%lld,%lld,%lld,%lld\n", elapsedSec(&sampleOrigin, t), st->index, (int)st->pid,
+                st->argv[0], cpu, rss, st->rchar, st->wchar, st->readBytes, st->writeBytes);
+    }
+}
+
+// wait for every command of the pipeline and report each one as soon as it terminates
+// a pidfd per command is watched with epoll, kernels without pidfd fall back to a wait4 loop
+// with --sample, a timerfd in the same epoll set samples every running command from /proc
+void reapPipeline(struct stage stages[], int nstage) {
+    struct epoll_event ev, events[MAX_STAGES + 1];
+    struct itimerspec its;
+    struct timespec t;
+    uint64_t expired;
+    int pidfd[MAX_STAGES];
+    int epfd, tfd = -1, k, n, running = 0;
+
+    signal(SIGINT, SIG_IGN);
+    for (k = 0; k < nstage; k++) {
+        if (!stages[k].reaped)
+            running++;
+    } // a command that failed to spawn is already reported
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    for (k = 0; k < nstage && epfd >= 0; k++) {
+        pidfd[k] = -1;
+        if (stages[k].reaped)
+            continue;
+        pidfd[k] = syscall(SYS_pidfd_open, stages[k].pid, 0);
+        if (pidfd[k] < 0) {
+            while (k-- > 0)
+                if (pidfd[k] >= 0)
+                    close(pidfd[k]);
+            close(epfd);
+            epfd = -1;
+            break;
+        }
+        ev.events = EPOLLIN;
+        ev.data.u32 = k;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, pidfd[k], &ev);
+    }
+
+    if (epfd >= 0 && sampleMs > 0) {
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        its.it_value.tv_sec = its.it_interval.tv_sec = sampleMs / 1000;
+        its.it_value.tv_nsec = its.it_interval.tv_nsec = sampleMs % 1000 * 1000000L;
+        timerfd_settime(tfd, 0, &its, NULL);
+        ev.events = EPOLLIN;
+        ev.data.u32 = MAX_STAGES; // not a command
+        epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+        for (k = 0; k < nstage; k++)
+            stages[k].sampled = stages[k].start;
+    }
+
+    if (epfd >= 0) {
+        while (running > 0) {
+            n = epoll_wait(epfd, events, MAX_STAGES + 1, -1);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                perror("epoll_wait()");
+                break;
+            }
+            for (i = 0; i < n; i++) { // a pidfd becomes readable when its process terminates
+                k = events[i].data.u32;
+                if (k == MAX_STAGES) { // sampler tick
+                    read(tfd, &expired, sizeof(expired));
+                    now(&t);
+                    for (k = 0; k < nstage; k++)
+                        if (!stages[k].reaped)
+                            sampleStage(&stages[k], &t);
+                    continue;
+                }
+                reapStage(&stages[k], WNOHANG);
+                if (stages[k].reaped) {
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, pidfd[k], NULL);
+                    close(pidfd[k]);
+                    running--;
+                }
+            }
+        }
+        if (tfd >= 0)
+            close(tfd);
+        close(epfd);
+    }
+
+    while (running > 0) { // fallback, or whatever is left after an epoll error
+        siginfo_t info;
+
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) < 0) {
+            perror("waitid()");
+            break;
+        } // find the next terminated child but leave it for wait4 to collect its rusage
+        for (k = 0; k < nstage; k++) {
+            if (!stages[k].reaped && stages[k].pid == info.si_pid) {
+                reapStage(&stages[k], 0);
+                running--;
+                break;
+            }
+        }
+        if (k == nstage)
+            waitpid(info.si_pid, NULL, 0); // not one of ours
+    }
+}
+
+// print the statistics of the whole pipeline and the command that used most of the CPU
+void printPipelineTotal(struct stage stages[], int nstage) {
+    struct timespec first = stages[0].start, last = stages[0].end;
+    long utime = 0, stime = 0, minflt = 0, majflt = 0, nvcsw = 0, nivcsw = 0, cpu, maxcpu = -1;
+    int k, busiest = 0;
+
+    for (k = 0; k < nstage; k++) {
+        if (elapsedSec(&first, &stages[k].start) < 0)
+            first = stages[k].start;
+        if (elapsedSec(&last, &stages[k].end) > 0)
+            last = stages[k].end;
+        cpu = stages[k].usage.ru_utime.tv_sec * 1000000 + stages[k].usage.ru_utime.tv_usec
+            + stages[k].usage.ru_stime.tv_sec * 1000000 + stages[k].usage.ru_stime.tv_usec;
+        if (cpu > maxcpu) {
+            maxcpu = cpu;
+            busiest = k;
+        }
+        utime += stages[k].usage.ru_utime.tv_sec * 1000000 + stages[k].usage.ru_utime.tv_usec;
+        stime += stages[k].usage.ru_stime.tv_sec * 1000000 + stages[k].usage.ru_stime.tv_usec;
+        minflt += stages[k].usage.ru_minflt;
+        majflt += stages[k].usage.ru_majflt;
+        nvcsw += stages[k].usage.ru_nvcsw;
+        nivcsw += stages[k].usage.ru_nivcsw;
+    }
+
+    if (format != 0) { // command is the busiest command, the status is the one of the last command like in a shell
+        printRecord("pipeline", stages[0].job, -1, 0, stages[busiest].argv[0], stages[nstage - 1].status,
+                    elapsedSec(&first, &last), utime / 1e6, stime / 1e6, minflt, majflt, nvcsw, nivcsw, -1, -1L);
+        return;
+    }
+
+    printf("The running statistics for the pipeline of %d commands as follows: \n", nstage);
+    printf("real: %.06f s, ", elapsedSec(&first, &last));
+    printf("user: %ld.%06ld s, system: %ld.%06ld s \n", utime / 1000000, utime % 1000000, stime / 1000000, stime % 1000000);
+    printf("no. of page faults: %ld \n", minflt + majflt);
+    printf("no. of context switches: %ld \n", nvcsw + nivcsw);
+    printf("busiest command: %s (%.1f%% of the pipeline CPU time)\n\n", stages[busiest].argv[0],
+           utime + stime > 0 ? 100.0 * maxcpu / (utime + stime) : 0.0);
+}
+
+#define MAX_PROCS 4096                          // upper bound of processes tracked by --tree
+
+struct proc {                                   // one process of the tree below monitor (--tree)
+    pid_t pid, ppid;                            // ppid is the parent when first seen, before any reparenting
+    char comm[32];
+    int stage;                                  // index of the command for the top of the tree, -1 for a descendant
+    int exact;                                  // 1 when the values were read from the zombie, just before monitor reaped it
+    int gone;                                   // 1 once the process has been reaped
+    int orphan;                                 // 1 when first seen as a child of monitor, after its parent had exited
+    double utime, stime;                        // own CPU time in seconds (without its children)
+    long minflt, majflt, nvcsw, nivcsw;
+};
+
+struct proc procs[MAX_PROCS];
+int nprocs = 0;
+
+struct proc *findProc(pid_t pid) {
+    for (i = 0; i < nprocs; i++) {
+        if (procs[i].pid == pid)
+            return &procs[i];
+    }
+    return NULL;
+}
+
+// refresh the own counters of a tracked process from /proc/<pid>/stat and /proc/<pid>/status
+// (still readable while the process is a zombie)
+int readProcTree(struct proc *pr) {
+    char buf[4096], *p;
+    unsigned long ut, stm, minflt, majflt;
+    long long v;
+
+    if (readProc(pr->pid, "stat", buf, sizeof(buf)) <= 0 || (p = strrchr(buf, ')')) == NULL)
+        return 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu", &minflt, &majflt, &ut, &stm) != 4)
+        return 0;
+    pr->utime = (double)ut / sysconf(_SC_CLK_TCK);
+    pr->stime = (double)stm / sysconf(_SC_CLK_TCK);
+    pr->minflt = minflt;
+    pr->majflt = majflt;
+    if (readProc(pr->pid, "status", buf, sizeof(buf)) > 0) {
+        if ((v = procField(buf, "\nvoluntary_ctxt_switches:")) >= 0)
+            pr->nvcsw = v;
+        if ((v = procField(buf, "nonvoluntary_ctxt_switches:")) >= 0)
+            pr->nivcsw = v;
+    }
+    return 1;
+}
+
+// find the new descendants in /proc: a process belongs to the tree when its parent is tracked,
+// or when its parent is monitor (an orphan reparented to the subreaper)
+void scanTree(void) {
+    char buf[512], *p, comm[32];
+    struct dirent *de;
+    struct proc *pr;
+    pid_t pid, ppid, self = getpid();
+    int added, k;
+    DIR *dir;
+
+    do { // repeat until no new process, a child can be listed before its parent
+        added = 0;
+        dir = opendir("/proc");
+        if (dir == NULL)
+            return;
+        while ((de = readdir(dir)) != NULL && nprocs < MAX_PROCS) {
+            if (!isdigit((unsigned char)de->d_name[0]))
+                continue;
+            pid = atoi(de->d_name);
+            if (findProc(pid) != NULL || readProc(pid, "stat", buf, sizeof(buf)) <= 0)
+                continue;
+            p = strrchr(buf, ')');
+            if (p == NULL || sscanf(p + 2, "%*c %d", &ppid) != 1)
+                continue;
+            if (ppid != self && findProc(ppid) == NULL)
+                continue;
+            pr = &procs[nprocs++];
+            memset(pr, 0, sizeof(*pr));
+            pr->pid = pid;
+            pr->ppid = ppid;
+            pr->stage = -1;
+            pr->orphan = ppid == self; // the commands themselves are registered at launch, anything else of monitor was reparented
+            k = strchr(buf, '(') ? (int)(p - strchr(buf, '(') - 1) : 0;
+            snprintf(comm, sizeof(comm), "%.*s", k < 31 ? k : 31, strchr(buf, '(') + 1);
+            strcpy(pr->comm, comm);
+            added = 1;
+        }
+        closedir(dir);
+    } while (added);
+
+    for (k = 0; k < nprocs; k++) {
+        if (!procs[k].gone && !procs[k].exact)
+            readProcTree(&procs[k]);
+    }
+}
+
+void printTreeNode(int k, int depth) {// print a process and, indented below it, the processes it forked
+    struct proc *pr = &procs[k];
+    int c;
+
+    fprintf(summaryOut, "%*spid %d %s%s: user %.3f s, system %.3f s, page faults %ld, context switches %ld%s\n",
+           2 * depth, "", (int)pr->pid, pr->comm, pr->stage >= 0 ? " (command)" : pr->orphan ? " (orphan)" : "", pr->utime, pr->stime,
+           pr->minflt + pr->majflt, pr->nvcsw + pr->nivcsw, pr->exact ? "" : " (last sample)");
+    for (c = 0; c < nprocs; c++) {
+        if (procs[c].ppid == pr->pid && c != k)
+            printTreeNode(c, depth + 1);
+    }
+}
+
+// --tree: monitor is a child subreaper, so every descendant that loses its parent is reparented to monitor
+// SIGCHLD arrives through a signalfd, a timerfd scans /proc for new descendants and refreshes their counters;
+// the tree is complete when every command has terminated and monitor has no child left
+void reapTree(struct stage stages[], int nstage) {
+    struct epoll_event ev, events[2];
+    struct itimerspec its;
+    struct rusage before, after, usage;
+    struct timespec t;
+    struct signalfd_siginfo si;
+    struct proc *pr;
+    siginfo_t info;
+    sigset_t chld, oldmask;
+    uint64_t expired;
+    double utime = 0, stime = 0;
+    long faults = 0, cswitch = 0;
+    int epfd, sfd, tfd, k, n, e, status;
+
+    signal(SIGINT, SIG_IGN);
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &oldmask); // a SIGCHLD sent before this point is still pending
+    sfd = signalfd(-1, &chld, SFD_CLOEXEC | SFD_NONBLOCK);
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    its.it_value.tv_sec = its.it_interval.tv_sec = (sampleMs > 0 ? sampleMs : 10) / 1000;
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = (sampleMs > 0 ? sampleMs : 10) % 1000 * 1000000L;
+    timerfd_settime(tfd, 0, &its, NULL);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.fd = sfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev);
+    ev.data.fd = tfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+
+    getrusage(RUSAGE_CHILDREN, &before);
+    nprocs = 0;
+    for (k = 0; k < nstage; k++) {
+        if (stages[k].reaped)
+            continue;
+        pr = &procs[nprocs++];
+        memset(pr, 0, sizeof(*pr));
+        pr->pid = stages[k].pid;
+        pr->ppid = getpid();
+        pr->stage = k;
+        snprintf(pr->comm, sizeof(pr->comm), "%s", stages[k].argv[0]);
+        stages[k].sampled = stages[k].start;
+    }
+    scanTree();
+
+    for (;;) {
+        // reap everything that has terminated: a command, or an orphaned descendant
+        for (;;) {
+            memset(&info, 0, sizeof(info));
+            if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0 || info.si_pid == 0)
+                break;
+            pr = findProc(info.si_pid);
+            if (pr == NULL && nprocs < MAX_PROCS) { // exited before any scan saw it
+                pr = &procs[nprocs++];
+                memset(pr, 0, sizeof(*pr));
+                pr->pid = info.si_pid;
+                pr->ppid = getpid();
+                pr->stage = -1;
+                pr->orphan = 1;
+                if (readProc(pr->pid, "comm", pr->comm, sizeof(pr->comm)) > 0)
+                    pr->comm[strcspn(pr->comm, "\n")] = '\0';
+            }
+            if (pr != NULL) {
+                pr->exact = readProcTree(pr); // the zombie still has its final counters
+                pr->gone = 1;
+            }
+            for (k = 0; k < nstage; k++) {
+                if (!stages[k].reaped && stages[k].pid == info.si_pid)
+                    break;
+            }
+            if (k < nstage)
+                reapStage(&stages[k], 0);
+            else
+                wait4(info.si_pid, &status, 0, &usage);
+        }
+
+        for (k = 0; k < nstage && stages[k].reaped; k++)
+            ;
+        if (k == nstage && waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0 && errno == ECHILD)
+            break; // every command is done and no descendant is left
+
+        n = epoll_wait(epfd, events, 2, -1);
+        for (e = 0; e < n; e++) {
+            if (events[e].data.fd == sfd) {
+                while (read(sfd, &si, sizeof(si)) == sizeof(si))
+                    ; // the reaping happens at the top of the loop
+            }
+            else {
+                read(tfd, &expired, sizeof(expired));
+                scanTree();
+                now(&t);
+                for (k = 0; sampleMs > 0 && k < nstage; k++)
+                    if (!stages[k].reaped)
+                        sampleStage(&stages[k], &t);
+            }
+        }
+    }
+    getrusage(RUSAGE_CHILDREN, &after);
+
+    close(epfd);
+    close(tfd);
+    close(sfd);
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+
+    fprintf(summaryOut, "The process tree as follows: \n");
+    for (k = 0; k < nprocs; k++) {
+        if (procs[k].stage >= 0 || findProc(procs[k].ppid) == NULL)
+            printTreeNode(k, 1); // a command, or an orphan whose parent was never seen
+        utime += procs[k].utime;
+        stime += procs[k].stime;
+        faults += procs[k].minflt + procs[k].majflt;
+        cswitch += procs[k].nvcsw + procs[k].nivcsw;
+    }
+    fprintf(summaryOut, "The running statistics for the whole tree of %d processes as follows: \n", nprocs);
+    fprintf(summaryOut, "user: %.6f s, system: %.6f s \n", tvSec(&after.ru_utime) - tvSec(&before.ru_utime), tvSec(&after.ru_stime) - tvSec(&before.ru_stime));
+    fprintf(summaryOut, "no. of page faults: %ld \n", after.ru_minflt + after.ru_majflt - before.ru_minflt - before.ru_majflt);
+    fprintf(summaryOut, "no. of context switches: %ld \n", after.ru_nvcsw + after.ru_nivcsw - before.ru_nvcsw - before.ru_nivcsw);
+    fprintf(summaryOut, "attributed to the processes above: user %.3f s, system %.3f s, page faults %ld, context switches %ld \n\n",
+           utime, stime, faults, cswitch);
+}
+
+// once every command has been reaped: print the pipeline total and collect the relays
+void finishPipeline(struct stage stages[], int nstage, struct edge edges[]) {
+    int k;
+
+    if (nstage > 1)
+        printPipelineTotal(stages, nstage);
+    if (relayMode) {
+        for (k = 0; k < nstage - 1; k++) {
+            pthread_join(edges[k].tid, NULL);
+            printEdge(&edges[k], &stages[k], &stages[k + 1]);
+        }
+    }
+}
+
+// run a command line, a command without '!' is simply a pipeline of one command
+int commandWithPipe(int argnum, char *command[]) {
+    struct stage stages[MAX_STAGES];
+    struct edge edges[MAX_STAGES - 1];
+    char *cmdbuf[1001];
+    int nstage;
+
+    nstage = parsePipeline(argnum, command, cmdbuf, stages);
+    if (nstage < 0)
+        return -1;
+
+    startPipeline(stages, nstage, edges);
+    if (treeMode)
+        reapTree(stages, nstage);
+    else
+        reapPipeline(stages, nstage);
+    finishPipeline(stages, nstage, edges);
+    return 1;
+}
+
+
+  
+void do_cmd(int argnum, char* command[]) {
+    commandWithPipe(argnum, command);
+}
+
+// launch the command once with stdout on /dev/null and return the launch latency in microseconds:
+// the time from the launch call until the exec in the child closes an O_CLOEXEC pipe
+// the round trip until the command has been reaped is returned in *roundtrip
+double timeLaunch(char *path, char *argv[], int useSpawn, int devnull, double *roundtrip) {
+    struct timespec t0, t1, t2;
+    int cx[2], status;
+    pid_t pid;
+    char c;
+
+    if (pipe2(cx, O_CLOEXEC) < 0) {
+        perror("pipe2()");
+        exit(1);
+    }
+
+    now(&t0);
+    if (useSpawn) {
+        posix_spawn_file_actions_t actions;
+
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, devnull, STDOUT_FILENO);
+        if (posix_spawn(&pid, path, &actions, NULL, argv, environ) != 0)
+            pid = -1;
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    else {
+        pid = fork();
+        if (pid == 0) {
+            dup2(devnull, STDOUT_FILENO);
+            execve(path, argv, environ);
+            _exit(1);
+        }
+    }
+    close(cx[1]);
+    while (read(cx[0], &c, 1) < 0 && errno == EINTR)
+        ; // end of file once the child has exec'd (or exited)
+    now(&t1);
+    close(cx[0]);
+
+    if (pid < 0) {
+        printExecError(argv[0]);
+        exit(1);
+    }
+    waitpid(pid, &status, 0);
+    now(&t2);
+
+    *roundtrip = elapsedSec(&t0, &t2) * 1e6;
+    return elapsedSec(&t0, &t1) * 1e6;
+}
+
+// --launch-bench N: compare fork+exec with posix_spawn for the same command
+// --ballast MB grows the resident set of monitor first, to show the cost of copying page tables in fork()
+void launchBench(int argnum, char *command[], int runs) {
+    double sum[2] = {0, 0}, min[2], max[2] = {0, 0}, trip[2] = {0, 0}, t, rt;
+    const char *name[2] = {"fork+exec", "posix_spawn"};
+    char *argv[1001], *path;
+    char *ballast = NULL;
+    int devnull, m, r;
+
+    for (j = 0; j < argnum; j++) {
+        if (strcmp(command[j], "!") == 0) {
+            printf("monitor: --launch-bench takes a single command without '!'\n");
+            exit(1);
+        }
+        argv[j] = command[j];
+    }
+    argv[argnum] = NULL;
+    path = resolveCommand(argv[0]);
+    if (path == NULL) {
+        printExecError(argv[0]);
+        exit(1);
+    }
+
+    if (ballastMB > 0) {
+        ballast = malloc((size_t)ballastMB << 20);
+        if (ballast == NULL) {
+            perror("malloc()");
+            exit(1);
+        }
+        memset(ballast, 1, (size_t)ballastMB << 20); // touch every page so that it is mapped
+    }
+
+    devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    for (m = 0; m < 2; m++) {
+        min[m] = 1e30;
+        for (r = 0; r < runs; r++) {
+            t = timeLaunch(path, argv, m, devnull, &rt);
+            sum[m] += t;
+            trip[m] += rt;
+            if (t < min[m])
+                min[m] = t;
+            if (t > max[m])
+                max[m] = t;
+        }
+    }
+    close(devnull);
+
+    printf("The launch latency of %s over %d runs (ballast: %d MB) as follows: \n", argv[0], runs, ballastMB);
+    for (m = 0; m < 2; m++) {
+        printf("%-12s launch: mean %.1f us, min %.1f us, max %.1f us, round trip: mean %.1f us \n",
+               name[m], sum[m] / runs, min[m], max[m], trip[m] / runs);
+    }
+    printf("posix_spawn launches %.2fx faster than fork+exec\n\n", sum[1] > 0 ? sum[0] / sum[1] : 0.0);
+    free(ballast);
+}
+
+struct job {                                    // one command line of --batch
+    int id;                                     // line number in the batch file
+    char *line;                                 // copy of the command line, the tokens point into it
+    char *tokens[1000];
+    int ntokens;
+    char *cmdbuf[1001];
+    struct stage stages[MAX_STAGES];
+    struct edge edges[MAX_STAGES - 1];
+    int nstage, running;                        // commands in the pipeline, commands not reaped yet
+    int pidfd[MAX_STAGES];
+    struct timespec start;                      // monotonic time at the launch of the first command
+};
+
+int compareDouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double squareRoot(double x) {// Newton's iteration, so that monitor builds without -lm
+    double r = x > 1.0 ? x : 1.0, prev;
+
+    if (x <= 0.0)
+        return 0.0;
+    do {
+        prev = r;
+        r = (r + x / r) / 2;
+    } while (r < prev); // decreasing from above until it settles
+    return prev < r ? prev : r;
+}
+
+double percentile(double sorted[], int n, double p) {// nearest-rank percentile of a sorted sample
+    int rank = (int)(p / 100.0 * n + 0.999999);
+
+    if (n == 0)
+        return 0.0;
+    if (rank < 1)
+        rank = 1;
+    return sorted[(rank > n ? n : rank) - 1];
+}
+
+// read the next non-empty command line into the job and start it; returns 0 at the end of the file
+int startJob(FILE *in, struct job *jb, int *lineno, int epfd) {
+    struct epoll_event ev;
+    size_t cap = 0;
+    char *save, *tok;
+    int argc, k;
+
+    for (;;) {
+        free(jb->line);
+        jb->line = NULL;
+        if (getline(&jb->line, &cap, in) < 0)
+            return 0;
+        (*lineno)++;
+        jb->line[strcspn(jb->line, "\n")] = '\0';
+
+        argc = 0;
+        for (tok = strtok_r(jb->line, " \t", &save); tok != NULL && argc < 1000; tok = strtok_r(NULL, " \t", &save))
+            jb->tokens[argc++] = tok;
+        if (argc == 0 || jb->tokens[0][0] == '#')
+            continue; // blank line or comment
+
+        jb->ntokens = argc;
+        jb->nstage = parsePipeline(argc, jb->tokens, jb->cmdbuf, jb->stages);
+        if (jb->nstage > 0)
+            break;
+        printf("monitor: skipped line %d of the batch\n", *lineno);
+    }
+
+    jb->id = *lineno;
+    for (k = 0; k < jb->nstage; k++)
+        jb->stages[k].job = jb->id;
+    now(&jb->start);
+    startPipeline(jb->stages, jb->nstage, jb->edges);
+    for (k = 0; k < jb->nstage; k++)
+        jb->stages[k].sampled = jb->stages[k].start; // CPU% of the first --sample tick is since the launch
+
+    jb->running = 0;
+    for (k = 0; k < jb->nstage; k++) {
+        jb->pidfd[k] = -1;
+        if (jb->stages[k].reaped)
+            continue; // failed to spawn
+        jb->running++;
+        if (epfd < 0)
+            continue;
+        jb->pidfd[k] = syscall(SYS_pidfd_open, jb->stages[k].pid, 0);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &jb->stages[k];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, jb->pidfd[k], &ev);
+    }
+    return 1;
+}
+
+// every command of the job has been reaped: print the whole job in one piece
+double finishJob(struct job *jb) {
+    struct timespec end;
+    int k;
+
+    now(&end);
+    if (format == 0) {
+        printf("Job at line %d:", jb->id);
+        for (k = 0; k < jb->ntokens; k++)
+            printf(" %s", jb->tokens[k]);
+        printf("\n");
+    }
+    for (k = 0; k < jb->nstage; k++)
+        printStage(&jb->stages[k]);
+    finishPipeline(jb->stages, jb->nstage, jb->edges);
+    return elapsedSec(&jb->start, &end);
+}
+
+// --batch FILE -j N: run every line of FILE as a command line, at most N of them at the same time
+// all the commands of all the running jobs are watched by one epoll set of pidfds (a wait4 loop without pidfd),
+// a new line is started as soon as a job completes; with --sample a timerfd in the same set samples every
+// running command of every job
+void runBatch(void) {
+    struct epoll_event ev, events[MAX_STAGES];
+    struct itimerspec its;
+    struct job *slots;
+    struct timespec begin, finish, t;
+    double *latency = NULL, elapsed;
+    uint64_t expired;
+    int cap = 0, done = 0, active = 0, eof = 0, lineno = 0;
+    int epfd, tfd = -1, n, e, k, s;
+    FILE *in;
+
+    in = strcmp(batchFile, "-") == 0 ? stdin : fopen(batchFile, "r");
+    if (in == NULL) {
+        perror(batchFile);
+        exit(1);
+    }
+    if (maxJobs < 1)
+        maxJobs = 1;
+    slots = calloc(maxJobs, sizeof(struct job));
+    int busy[maxJobs];
+    memset(busy, 0, sizeof(busy));
+
+    reportOnReap = 0;
+    signal(SIGINT, SIG_IGN);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd >= 0) {
+        int probe = syscall(SYS_pidfd_open, getpid(), 0);
+        if (probe < 0) {
+            close(epfd);
+            epfd = -1;
+        }
+        else close(probe);
+    } // without pidfd the reaper blocks in wait4(-1)
+    if (epfd >= 0 && sampleMs > 0) {
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        its.it_value.tv_sec = its.it_interval.tv_sec = sampleMs / 1000;
+        its.it_value.tv_nsec = its.it_interval.tv_nsec = sampleMs % 1000 * 1000000L;
+        timerfd_settime(tfd, 0, &its, NULL);
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL; // not a command
+        epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+    }
+    else if (sampleMs > 0)
+        printf("monitor: --sample needs pidfd support, the batch is not sampled\n");
+
+    now(&begin);
+    for (;;) {
+        for (s = 0; s < maxJobs && !eof; s++) { // fill the free slots
+            if (busy[s])
+                continue;
+            if (!startJob(in, &slots[s], &lineno, epfd)) {
+                eof = 1;
+                break;
+            }
+            busy[s] = 1;
+            active++;
+        }
+
+        for (s = 0; s < maxJobs; s++) { // collect the jobs whose commands have all terminated
+            if (!busy[s] || slots[s].running > 0)
+                continue;
+            if (done == cap) {
+                cap = cap ? 2 * cap : 64;
+                latency = realloc(latency, cap * sizeof(double));
+            }
+            latency[done++] = finishJob(&slots[s]);
+            busy[s] = 0;
+            active--;
+        }
+        if (active == 0 && eof)
+            break;
+        if (active == 0 || (active < maxJobs && !eof))
+            continue;
+
+        if (epfd >= 0) {
+            n = epoll_wait(epfd, events, MAX_STAGES, -1);
+            for (e = 0; e < n; e++) {
+                struct stage *st = events[e].data.ptr;
+
+                if (st == NULL) { // sampler tick
+                    read(tfd, &expired, sizeof(expired));
+                    now(&t);
+                    for (s = 0; s < maxJobs; s++)
+                        for (k = 0; busy[s] && k < slots[s].nstage; k++)
+                            if (!slots[s].stages[k].reaped)
+                                sampleStage(&slots[s].stages[k], &t);
+                    continue;
+                }
+                reapStage(st, WNOHANG);
+                if (!st->reaped)
+                    continue;
+                for (s = 0; s < maxJobs; s++) {
+                    k = st - slots[s].stages;
+                    if (busy[s] && k >= 0 && k < slots[s].nstage) {
+                        epoll_ctl(epfd, EPOLL_CTL_DEL, slots[s].pidfd[k], NULL);
+                        close(slots[s].pidfd[k]);
+                        slots[s].running--;
+                        break;
+                    }
+                }
+            }
+        }
+        else {
+            int status;
+            struct rusage usage;
+            pid_t pid = wait4(-1, &status, 0, &usage);
+
+            if (pid < 0)
+                break;
+            for (s = 0; s < maxJobs; s++) {
+                for (k = 0; busy[s] && k < slots[s].nstage; k++) {
+                    struct stage *st = &slots[s].stages[k];
+
+                    if (!st->reaped && st->pid == pid) {
+                        st->status = status;
+                        st->usage = usage;
+                        now(&st->end);
+                        st->reaped = 1;
+                        st->lastCpu = -1; // already released, /proc has nothing left
+                        if (perfMode)
+                            readPerf(st);
+                        slots[s].running--;
+                    }
+                }
+            }
+        }
+    }
+    now(&finish);
+    elapsed = elapsedSec(&begin, &finish);
+
+    qsort(latency, done, sizeof(double), compareDouble);
+    fprintf(summaryOut, "The batch statistics for %d jobs with -j %d as follows: \n", done, maxJobs);
+    fprintf(summaryOut, "real: %.06f s, throughput: %.02f jobs/s \n", elapsed, elapsed > 0 ? done / elapsed : 0.0);
+    fprintf(summaryOut, "job latency: p50 %.06f s, p95 %.06f s, p99 %.06f s, max %.06f s \n\n",
+           percentile(latency, done, 50), percentile(latency, done, 95),
+           percentile(latency, done, 99), done ? latency[done - 1] : 0.0);
+
+    if (tfd >= 0)
+        close(tfd);
+    if (epfd >= 0)
+        close(epfd);
+    if (in != stdin)
+        fclose(in);
+    for (s = 0; s < maxJobs; s++)
+        free(slots[s].line);
+    free(slots);
+    free(latency);
+}
+
+// --runs N --warmup K: run the command line K times without recording, then N times,
+// and summarize the distribution of every statistic (a pipeline counts as the sum of its commands)
+void runRepeated(int argnum, char *command[]) {
+    const char *metric[5] = {"real (s)", "user (s)", "system (s)", "page faults", "context switches"};
+    struct stage stages[MAX_STAGES];
+    struct edge edges[MAX_STAGES - 1];
+    char *cmdbuf[1001];
+    double *sample[5], mean, var;
+    struct timespec first, last;
+    int nstage, k, m, r;
+
+    nstage = parsePipeline(argnum, command, cmdbuf, stages);
+    if (nstage < 0)
+        return;
+    if (runs < 1)
+        runs = 1;
+    for (m = 0; m < 5; m++)
+        sample[m] = calloc(runs, sizeof(double));
+
+    reportOnReap = 0;
+    for (r = -warmup; r < runs; r++) {
+        startPipeline(stages, nstage, edges);
+        reapPipeline(stages, nstage);
+        for (k = 0; relayMode && k < nstage - 1; k++)
+            pthread_join(edges[k].tid, NULL);
+        if (r < 0)
+            continue; // warm-up run
+
+        first = stages[0].start;
+        last = stages[0].end;
+        for (k = 0; k < nstage; k++) {
+            struct rusage *ru = &stages[k].usage;
+
+            if (elapsedSec(&first, &stages[k].start) < 0)
+                first = stages[k].start;
+            if (elapsedSec(&last, &stages[k].end) > 0)
+                last = stages[k].end;
+            sample[1][r] += tvSec(&ru->ru_utime);
+            sample[2][r] += tvSec(&ru->ru_stime);
+            sample[3][r] += ru->ru_minflt + ru->ru_majflt;
+            sample[4][r] += ru->ru_nvcsw + ru->ru_nivcsw;
+        }
+        sample[0][r] = elapsedSec(&first, &last);
+    }
+    reportOnReap = 1;
+
+    fprintf(summaryOut, "The running statistics for %d runs of %s (%d warm-up runs) as follows: \n", runs, command[0], warmup);
+    fprintf(summaryOut, "%-18s %12s %12s %12s %12s %12s %12s\n", "", "min", "median", "p95", "p99", "max", "stddev");
+    for (m = 0; m < 5; m++) {
+        mean = var = 0.0;
+        for (r = 0; r < runs; r++)
+            mean += sample[m][r] / runs;
+        for (r = 0; r < runs; r++)
+            var += (sample[m][r] - mean) * (sample[m][r] - mean) / runs;
+        qsort(sample[m], runs, sizeof(double), compareDouble);
+
+        fprintf(summaryOut, m < 3 ? "%-18s %12.6f %12.6f %12.6f %12.6f %12.6f %12.6f\n" : "%-18s %12.0f %12.1f %12.0f %12.0f %12.0f %12.1f\n",
+               metric[m], sample[m][0], (sample[m][(runs - 1) / 2] + sample[m][runs / 2]) / 2,
+               percentile(sample[m], runs, 95), percentile(sample[m], runs, 99), sample[m][runs - 1], squareRoot(var));
+        free(sample[m]);
+    }
+    fprintf(summaryOut, "\n");
+}
+
+// read one request of --client: the number of arguments on a line of its own, then every argument
+// terminated by a NUL byte, so an argument keeps its spaces, tabs and newlines
+// returns the number of arguments, 0 at the end of the connection and -1 when the request does not fit
+int readRequest(FILE *in, char *buf, int size, char *tokens[], int max) {
+    char count[32];
+    int argc, n = 0, c, k;
+
+    if (fgets(count, sizeof(count), in) == NULL)
+        return 0;
+    argc = atoi(count);
+    if (argc < 1 || argc >= max)
+        return -1;
+    for (k = 0; k < argc; k++) {
+        tokens[k] = buf + n;
+        while ((c = getc(in)) != EOF && c != '\0') {
+            if (n >= size - 1)
+                return -1;
+            buf[n++] = c;
+        }
+        if (c == EOF)
+            return -1;
+        buf[n++] = '\0';
+    }
+    return argc;
+}
+
+// one launcher of --serve: accept a connection, then run every request received on it as a command line
+// and answer with the json records of its commands, closed by a "done" record
+// the commands write to the stdout and stderr of the server, only the records go back to the client
+void serveConnections(int lfd) {
+    char args[8192], *tokens[1000];
+    FILE *in;
+    int cfd, argc, devnull;
+
+    devnull = open("/dev/null", O_RDONLY);
+    dup2(devnull, STDIN_FILENO); // the commands must not read the requests
+    close(devnull);
+    format = 1;
+    reportOnReap = 1;
+
+    for (;;) {
+        cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept()");
+            _exit(1);
+        }
+        in = fdopen(cfd, "r");
+        statsOut = fdopen(dup(cfd), "w");
+        fcntl(fileno(statsOut), F_SETFD, FD_CLOEXEC);
+
+        while ((argc = readRequest(in, args, sizeof(args), tokens, 1000)) != 0) {
+            if (argc < 0) { // the framing is lost, drop the connection
+                fprintf(statsOut, "{\"type\":\"error\",\"message\":\"malformed or oversized request\"}\n");
+                fprintf(statsOut, "{\"type\":\"done\"}\n");
+                break;
+            }
+            argnum = argc;
+            for (i = 0; i < argc; i++)
+                command[i] = tokens[i];
+            if (commandWithPipe(argnum, command) < 0)
+                fprintf(statsOut, "{\"type\":\"error\",\"message\":\"cannot start the command line\"}\n");
+            fprintf(statsOut, "{\"type\":\"done\"}\n");
+            fflush(statsOut);
+        }
+        fclose(statsOut);
+        fclose(in);
+    }
+}
+
+// --serve PATH: keep --workers launchers forked and waiting on a Unix domain socket at PATH,
+// so a caller pays one connect() and one request per measurement instead of starting monitor
+// the supervisor replaces a launcher that dies and removes the socket on SIGINT/SIGTERM
+char *servePath = NULL;                         // --serve: path of the Unix domain socket
+char *clientPath = NULL;                        // --client: path of the socket of a --serve monitor
+pid_t *launchers;                               // pids of the --serve launchers
+
+void stopServer(int sig) {
+    int w; // not the global i, the handler may interrupt a loop on it
+
+    (void)sig;
+    for (w = 0; w < serveWorkers; w++)
+        kill(launchers[w], SIGTERM);
+    unlink(servePath);
+    _exit(0);
+}
+
+void runServer(char *path) {
+    struct sockaddr_un addr;
+    pid_t pid;
+    int lfd, w;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("monitor: socket path too long: %s\n", path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 64) < 0) {
+        perror(path);
+        exit(1);
+    }
+
+    if (serveWorkers < 1)
+        serveWorkers = 1;
+    servePath = path;
+    launchers = calloc(serveWorkers, sizeof(pid_t));
+    fflush(stdout);
+    for (w = 0; w < serveWorkers; w++) {
+        launchers[w] = fork();
+        if (launchers[w] == 0)
+            serveConnections(lfd);
+    }
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    printf("monitor: serving on %s with %d launchers\n", path, serveWorkers);
+    fflush(stdout);
+
+    for (;;) {
+        pid = wait(NULL);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (w = 0; w < serveWorkers; w++) {
+            if (launchers[w] == pid) {
+                launchers[w] = fork();
+                if (launchers[w] == 0) {
+                    signal(SIGINT, SIG_DFL);
+                    signal(SIGTERM, SIG_DFL);
+                    serveConnections(lfd);
+                }
+            }
+        }
+    }
+}
+
+// --client PATH: send one command line to a --serve launcher and print its records
+// the arguments go as they are (see readRequest), the exit status is the status of the last command
+// (the records come in reap order, so it is the one with the highest stage; 128+N for a death by signal N)
+int runClient(char *path, int argc, char *argv[]) {
+    struct sockaddr_un addr;
+    char line[8192];
+    FILE *io;
+    int fd, status = 0, last = -1, stage, sig;
+    char *p;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        return 1;
+    }
+    io = fdopen(fd, "r+");
+    fprintf(io, "%d\n", argc);
+    for (i = 0; i < argc; i++) {
+        fputs(argv[i], io);
+        putc('\0', io);
+    }
+    fflush(io);
+
+    while (fgets(line, sizeof(line), io) != NULL) {
+        if (strstr(line, "\"type\":\"done\"") != NULL)
+            break;
+        fputs(line, stdout);
+        if (strstr(line, "\"type\":\"process\"") != NULL && (p = strstr(line, "\"stage\":")) != NULL &&
+            (stage = atoi(p + strlen("\"stage\":"))) > last && (p = strstr(line, "\"exit_status\":")) != NULL) {
+            last = stage;
+            status = atoi(p + strlen("\"exit_status\":"));
+            if ((p = strstr(line, "\"signal\":")) != NULL && (sig = atoi(p + strlen("\"signal\":"))) > 0)
+                status = 128 + sig;
+        }
+        if (strstr(line, "\"type\":\"error\"") != NULL)
+            status = 1;
+    }
+    fclose(io);
+    return status;
+}
+
+void usage(void) {
+    printf("Usage: monitor [options] command [args] [! command [args]] ...\n");
+    printf("       monitor [options] --batch FILE [-j N]\n");
+    printf("       monitor [options] --serve SOCKET [--workers N]\n");
+    printf("       monitor --client SOCKET command [args] [! command [args]] ...\n");
+    printf("  --batch FILE     run every line of FILE (- for stdin) as a command line\n");
+    printf("  -j N             run at most N command lines of --batch at the same time\n");
+    printf("  --runs N         run the command line N times and summarize min/median/p95/p99/max/stddev\n");
+    printf("  --warmup K       run the command line K more times before --runs, without recording them\n");
+    printf("  --format F       text (default), json (one object per line) or csv: one record per process\n");
+    printf("  --output FILE    write the json/csv records to FILE instead of stdout\n");
+    printf("  --sample MS      sample CPU%%, RSS and I/O of every running command from /proc every MS ms\n");
+    printf("  --timeline FILE  write every sample of --sample to FILE as csv\n");
+    printf("  --serve SOCKET   keep launchers waiting on a Unix socket, one command line per request, json replies\n");
+    printf("  --workers N      number of launchers of --serve (default 2)\n");
+    printf("  --client SOCKET  run the command line through a --serve launcher and print its records\n");
+    printf("                   (the output of the commands goes to the terminal of the server)\n");
+    printf("  --tree           become a child subreaper and report every descendant as a process tree\n");
+    printf("  --perf           count cycles, instructions, cache/branch misses, task-clock and migrations per command\n");
+    printf("  a command can be prefixed with @cpus=LIST (e.g. 0-3,8), @nice=N and @sched=other|batch|idle\n");
+    printf("  --relay          relay the data between the commands with splice() and report every pipe\n");
+    printf("  --pipe-size N    set the capacity of every pipe to N bytes (F_SETPIPE_SZ)\n");
+    printf("  --spawn          start the commands with posix_spawn() instead of fork() + execve()\n");
+    printf("  --launch-bench N compare the launch latency of fork+exec and posix_spawn over N runs\n");
+    printf("  --ballast MB     grow monitor by MB of touched memory before --launch-bench\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int arg;
+
+    statsOut = stdout;
+    for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "--") == 0) {
+            arg++;
+            break;
+        }
+        else if (strcmp(argv[arg], "--relay") == 0)
+            relayMode = 1;
+        else if (strcmp(argv[arg], "--pipe-size") == 0 && arg + 1 < argc)
+            pipeSize = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--spawn") == 0)
+            spawnMode = 1;
+        else if (strcmp(argv[arg], "--launch-bench") == 0 && arg + 1 < argc)
+            benchRuns = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--ballast") == 0 && arg + 1 < argc)
+            ballastMB = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--batch") == 0 && arg + 1 < argc)
+            batchFile = argv[++arg];
+        else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc)
+            maxJobs = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--runs") == 0 && arg + 1 < argc)
+            runs = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--warmup") == 0 && arg + 1 < argc)
+            warmup = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--format") == 0 && arg + 1 < argc) {
+            arg++;
+            if (strcmp(argv[arg], "text") == 0)
+                format = 0;
+            else if (strcmp(argv[arg], "json") == 0)
+                format = 1;
+            else if (strcmp(argv[arg], "csv") == 0)
+                format = 2;
+            else
+                usage();
+        }
+        else if (strcmp(argv[arg], "--serve") == 0 && arg + 1 < argc)
+            servePath = argv[++arg];
+        else if (strcmp(argv[arg], "--workers") == 0 && arg + 1 < argc)
+            serveWorkers = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--client") == 0 && arg + 1 < argc)
+            clientPath = argv[++arg];
+        else if (strcmp(argv[arg], "--tree") == 0)
+            treeMode = 1;
+        else if (strcmp(argv[arg], "--perf") == 0)
+            perfMode = 1;
+        else if (strcmp(argv[arg], "--sample") == 0 && arg + 1 < argc)
+            sampleMs = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--timeline") == 0 && arg + 1 < argc) {
+            timeline = fopen(argv[++arg], "w");
+            if (timeline == NULL) {
+                perror(argv[arg]);
+                exit(1);
+            }
+            fprintf(timeline, "t_s,stage,pid,command,cpu_pct,rss_kb,rchar,wchar,read_bytes,write_bytes\n");
+        }
+        else if (strcmp(argv[arg], "--output") == 0 && arg + 1 < argc) {
+            statsOut = fopen(argv[++arg], "w");
+            if (statsOut == NULL) {
+                perror(argv[arg]);
+                exit(1);
+            }
+        }
+        else
+            usage();
+    } // options end at the first argument that is not an option
+    summaryOut = format != 0 ? stderr : stdout; // keep the json/csv stream clean
+    if (timeline != NULL && sampleMs <= 0)
+        sampleMs = 10;
+    now(&sampleOrigin);
+
+    if (batchFile != NULL && treeMode) {
+        printf("monitor: --tree cannot be combined with --batch, the descendants of parallel jobs are not told apart\n");
+        exit(1);
+    }
+    if ((runs > 0 || warmup > 0) && treeMode) {
+        printf("monitor: --tree cannot be combined with --runs or --warmup, the repeated runs are not reaped as a tree\n");
+        exit(1);
+    }
+    if (treeMode && prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+        perror("prctl(PR_SET_CHILD_SUBREAPER)");
+        exit(1);
+    }
+    if (batchFile != NULL) {
+        runBatch();
+        return 0;
+    }
+    if (servePath != NULL) {
+        runServer(servePath);
+        return 0;
+    }
+    if (clientPath != NULL)
+        return runClient(clientPath, argc - arg, argv + arg);
+    if (arg == argc) {exit(0);} 
+    argnum = argc-arg;
+    for (i = 0; i < argnum; i++) {
+        command[i]= argv[i+arg] ;
+        }                    // build command
+    if (benchRuns > 0) {
+        launchBench(argnum, command, benchRuns);
+        return 0;
+    }
+    if (runs > 0 || warmup > 0) {
+        runRepeated(argnum, command);
+        return 0;
+    }
+    do_cmd(argnum, command); // implement command
+    return 0;
+} // main